@@ -6,11 +6,15 @@
 #include <string>
 #include <unordered_map>
 #include <stdexcept>
+#include <algorithm>
+#include <type_traits>
 
 #include "cam.hpp"
 
 // Реализация TypeVar
-TypeVar::TypeVar(int i) : id(i) {}
+static uint64_t typevar_serial = 0;
+
+TypeVar::TypeVar(int i) : id(i), serial(typevar_serial++) {}
 
 // Реализация TypeArrow
 TypeArrow::TypeArrow(Type f, Type t) : from(f), to(t) {}
@@ -22,7 +26,9 @@ TypeConst::TypeConst(const std::string& n) : name(n) {}
 int TypeVarGenerator::counter = 0;
 
 int TypeVarGenerator::next() { return counter++; }
+int TypeVarGenerator::peek() { return counter; }
 void TypeVarGenerator::reset() { counter = 0; }
+uint64_t TypeVarGenerator::created() { return typevar_serial; }
 
 // Функции для создания типов
 Type make_typevar() {
@@ -33,19 +39,86 @@ Type make_typevar(int id) {
     return std::make_shared<TypeVar>(id);
 }
 
+// Таблица интернирования: структурно равные стрелки и константы — один узел,
+// поэтому их равенство — сравнение указателей. Ссылки в таблице слабые,
+// протухшие записи вычищаются, когда таблица вырастает вдвое
+template <typename Key, typename Node, typename Hash = std::hash<Key>>
+class InternTable {
+    std::unordered_map<Key, std::weak_ptr<Node>, Hash> nodes;
+    size_t sweep_at = 1024;
+    
+public:
+    template <typename Make>
+    std::shared_ptr<Node> intern(const Key& key, Make make) {
+        std::weak_ptr<Node>& slot = nodes[key];
+        if (auto node = slot.lock()) return node;
+        std::shared_ptr<Node> node = make();
+        slot = node;
+        if (nodes.size() >= sweep_at) {
+            for (auto it = nodes.begin(); it != nodes.end();) {
+                if (it->second.expired()) it = nodes.erase(it);
+                else ++it;
+            }
+            sweep_at = std::max<size_t>(1024, 2 * nodes.size());
+        }
+        return node;
+    }
+    
+    size_t size() const { return nodes.size(); }
+};
+
+// Узлы типов различаются адресом, пока живы: стрелка держит свои части,
+// поэтому адрес в ключе живой записи не может быть переиспользован
+static const void* type_identity(const Type& type) {
+    return std::visit([](const auto& node) -> const void* { return node.get(); }, type);
+}
+
+struct ArrowKeyHash {
+    size_t operator()(const std::pair<const void*, const void*>& key) const {
+        return std::hash<const void*>()(key.first) * 0x9E3779B97F4A7C15ull ^ std::hash<const void*>()(key.second);
+    }
+};
+
+static InternTable<std::pair<const void*, const void*>, TypeArrow, ArrowKeyHash>& arrow_table() {
+    static InternTable<std::pair<const void*, const void*>, TypeArrow, ArrowKeyHash> table;
+    return table;
+}
+
+static InternTable<std::string, TypeConst>& const_table() {
+    static InternTable<std::string, TypeConst> table;
+    return table;
+}
+
 Type make_arrow(Type from, Type to) {
-    return std::make_shared<TypeArrow>(from, to);
+    return arrow_table().intern({type_identity(from), type_identity(to)},
+                                [&] { return std::make_shared<TypeArrow>(from, to); });
 }
 
 Type make_typeconst(const std::string& name) {
-    return std::make_shared<TypeConst>(name);
+    return const_table().intern(name, [&] { return std::make_shared<TypeConst>(name); });
+}
+
+size_t interned_types() {
+    return arrow_table().size() + const_table().size();
 }
 
 // Реализация выражений
 Constant::Constant(const std::string& n, Type t) : name(n), type(t) {}
-Variable::Variable(const std::string& n, Type t) : name(n), type(t) {}
-Lambda::Lambda(const std::string& p, Type pt, Expr b) : param(p), param_type(pt), body(b) {}
-Apply::Apply(Expr f, Expr a) : func(f), arg(a) {}
+Variable::Variable(const std::string& n, Type t) : name(n), type(t), free_mask(name_bit(n)) {}
+// Бит параметра не снимается: он может принадлежать и другой свободной переменной тела
+Lambda::Lambda(const std::string& p, Type pt, Expr b) : param(p), param_type(pt), body(b), free_mask(::free_mask(b)) {}
+Apply::Apply(Expr f, Expr a) : func(f), arg(a), free_mask(::free_mask(f) | ::free_mask(a)) {}
+
+uint64_t name_bit(const std::string& name) {
+    return uint64_t(1) << (std::hash<std::string>()(name) & 63);
+}
+
+uint64_t free_mask(const Expr& expr) {
+    return std::visit([](const auto& node) -> uint64_t {
+        if constexpr (std::is_same_v<std::decay_t<decltype(node)>, std::shared_ptr<Constant>>) return 0;
+        else return node->free_mask;
+    }, expr);
+}
 
 // Функции для создания выражений
 Expr make_constant(const std::string& name, Type type) {
@@ -65,79 +138,138 @@ Expr make_apply(Expr func, Expr arg) {
 }
 
 // Унификация типов
-void UnifyVisitor::operator()(const std::shared_ptr<TypeVar>& tv1) {
-    if (auto tv2 = std::get_if<std::shared_ptr<TypeVar>>(&t2)) {
-        if (tv1->id == (*tv2)->id) return;
-    }
-    
-    if (auto ta2 = std::get_if<std::shared_ptr<TypeArrow>>(&t2)) {
-        throw std::runtime_error("Cannot unify type variable with arrow type");
-    }
-    
-    if (auto tc2 = std::get_if<std::shared_ptr<TypeConst>>(&t2)) {
-        throw std::runtime_error("Cannot unify type variable with constant type");
-    }
-    
-    substitutions[tv1->id] = t2;
+// Все изменения переменных проходят через set_instance: сеанс вывода
+// передаёт журнал, чтобы откатить их при ошибке, свободные функции — nullptr.
+// Вне infer журнал сеанса ничего не записывает (first_fresh = 0)
+static void set_instance(const std::shared_ptr<TypeVar>& var, Type type, TypeJournal* journal) {
+    if (journal && var->serial < journal->first_fresh) journal->bindings.push_back({var, std::move(var->instance)});
+    var->instance = std::move(type);
 }
 
-void UnifyVisitor::operator()(const std::shared_ptr<TypeArrow>& ta1) {    
-    if (auto ta2 = std::get_if<std::shared_ptr<TypeArrow>>(&t2)) {
-        UnifyVisitor from_visitor((*ta2)->from, substitutions);
-        std::visit(from_visitor, ta1->from);
-        
-        UnifyVisitor to_visitor((*ta2)->to, substitutions);
-        std::visit(to_visitor, ta1->to);
-    } else if (auto tv2 = std::get_if<std::shared_ptr<TypeVar>>(&t2)) {
-        substitutions[(*tv2)->id] = Type(ta1);
-    } else {
-        throw std::runtime_error("Type mismatch in arrow unification");
+static Type find_root(Type type, TypeJournal* journal) {
+    auto tv = std::get_if<std::shared_ptr<TypeVar>>(&type);
+    if (!tv || !(*tv)->instance) return type;
+    Type root = find_root(*(*tv)->instance, journal);
+    if (root != *(*tv)->instance) set_instance(*tv, root, journal);
+    return root;
+}
+
+Type find_type(Type type) {
+    return find_root(type, nullptr);
+}
+
+static Type resolve_root(Type type, TypeJournal* journal) {
+    type = find_root(type, journal);
+    if (auto ta = std::get_if<std::shared_ptr<TypeArrow>>(&type)) {
+        Type from = resolve_root((*ta)->from, journal);
+        Type to = resolve_root((*ta)->to, journal);
+        if (from != (*ta)->from || to != (*ta)->to) return make_arrow(from, to);
     }
+    return type;
+}
+
+Type resolve_type(Type type) {
+    return resolve_root(type, nullptr);
 }
 
-void UnifyVisitor::operator()(const std::shared_ptr<TypeConst>& tc1) {
-    if (auto tc2 = std::get_if<std::shared_ptr<TypeConst>>(&t2)) {
-        if (tc1->name != (*tc2)->name) {
-            throw std::runtime_error("Type constant mismatch: " + tc1->name + " vs " + (*tc2)->name);
+static bool occurs(const std::shared_ptr<TypeVar>& var, Type type, TypeJournal* journal) {
+    std::vector<Type> pending{type};
+    while (!pending.empty()) {
+        Type t = find_root(pending.back(), journal);
+        pending.pop_back();
+        if (auto tv = std::get_if<std::shared_ptr<TypeVar>>(&t)) {
+            if (*tv == var) return true;
+        } else if (auto ta = std::get_if<std::shared_ptr<TypeArrow>>(&t)) {
+            pending.push_back((*ta)->from);
+            pending.push_back((*ta)->to);
         }
-    } else if (auto tv2 = std::get_if<std::shared_ptr<TypeVar>>(&t2)) {
-        substitutions[(*tv2)->id] = Type(tc1);
-    } else {
-        throw std::runtime_error("Type mismatch in constant unification");
     }
+    return false;
 }
 
-void unify(Type t1, Type t2, std::unordered_map<int, Type>& subs) {
-    auto apply_subs = [&](Type& t) {
-        if (auto tv = std::get_if<std::shared_ptr<TypeVar>>(&t)) {
-            auto it = subs.find((*tv)->id);
-            if (it != subs.end()) t = it->second;
+static void unify_types(Type t1, Type t2, TypeJournal* journal) {
+    std::vector<std::pair<Type, Type>> pending{{t1, t2}};
+    while (!pending.empty()) {
+        auto [a, b] = pending.back();
+        pending.pop_back();
+        a = find_root(a, journal);
+        b = find_root(b, journal);
+        // Интернированные равные типы — один узел, их обход не нужен
+        if (a == b) continue;
+        
+        auto va = std::get_if<std::shared_ptr<TypeVar>>(&a);
+        auto vb = std::get_if<std::shared_ptr<TypeVar>>(&b);
+        if (va && vb) {
+            // Объединение по рангу: к корню с большим рангом
+            std::shared_ptr<TypeVar> root = *va, child = *vb;
+            if (root->rank < child->rank) std::swap(root, child);
+            if (root->rank == child->rank) ++root->rank;
+            set_instance(child, Type(root), journal);
+            continue;
+        }
+        if (va || vb) {
+            std::shared_ptr<TypeVar> var = va ? *va : *vb;
+            Type other = va ? b : a;
+            if (occurs(var, other, journal)) {
+                throw std::runtime_error("Occurs check: ?" + std::to_string(var->id) +
+                                         " in " + type_to_string_full(other));
+            }
+            set_instance(var, other, journal);
+            continue;
+        }
+        
+        auto ta = std::get_if<std::shared_ptr<TypeArrow>>(&a);
+        auto tb = std::get_if<std::shared_ptr<TypeArrow>>(&b);
+        if (ta && tb) {
+            pending.push_back({(*ta)->to, (*tb)->to});
+            pending.push_back({(*ta)->from, (*tb)->from});
+            continue;
         }
-    };
+        if (ta || tb) throw std::runtime_error("Type mismatch in arrow unification");
+        
+        const std::string& name_a = std::get<std::shared_ptr<TypeConst>>(a)->name;
+        const std::string& name_b = std::get<std::shared_ptr<TypeConst>>(b)->name;
+        if (name_a != name_b) {
+            throw std::runtime_error("Type constant mismatch: " + name_a + " vs " + name_b);
+        }
+    }
+}
+
+void unify(Type t1, Type t2) {
+    unify_types(t1, t2, nullptr);
+}
+
+// Связывание параметра на время обхода тела лямбды: контекст не копируется,
+// затенённое значение возвращается на место при выходе, в том числе по исключению
+class ScopedBinding {
+    TypeContext& context;
+    std::string name;
+    std::optional<Type> shadowed;
     
-    apply_subs(t1);
-    apply_subs(t2);
+public:
+    ScopedBinding(TypeContext& context, const std::string& name, Type type) : context(context), name(name) {
+        auto [it, inserted] = context.try_emplace(name, type);
+        if (!inserted) {
+            shadowed = it->second;
+            it->second = type;
+        }
+    }
     
-    if (t1 == t2) return;
+    ~ScopedBinding() {
+        if (shadowed) context[name] = *shadowed;
+        else context.erase(name);
+    }
     
-    UnifyVisitor visitor(t2, subs);
-    std::visit(visitor, t1);
-}
+    ScopedBinding(const ScopedBinding&) = delete;
+    ScopedBinding& operator=(const ScopedBinding&) = delete;
+};
 
 // Вывод типа выражения
+// Весь терм обходится одним посетителем одного сеанса: связи переменных
+// накапливаются в узлах TypeVar, и полный тип строится один раз в infer
 struct InferVisitor {
+    TypeInference& session;
     TypeContext& context;
-    std::unordered_map<int, Type> substitutions;
-
-    Type apply_all_subs(Type t) {
-        if (auto tv = std::get_if<std::shared_ptr<TypeVar>>(&t)) {
-            auto it = substitutions.find((*tv)->id);
-            if (it != substitutions.end()) return apply_all_subs(it->second);
-        } else if (auto ta = std::get_if<std::shared_ptr<TypeArrow>>(&t)) {
-            return make_arrow(apply_all_subs((*ta)->from), apply_all_subs((*ta)->to));
-        }
-        return t;
-    }
     
     Type operator()(const std::shared_ptr<Constant>& c) {
         return c->type;
@@ -152,31 +284,21 @@ struct InferVisitor {
     }
     
     Type operator()(const std::shared_ptr<Lambda>& l) {
-        TypeContext new_context = context;
-        new_context[l->param] = l->param_type;
-        Type body_type = infer_type(l->body, new_context);
+        ScopedBinding binding(context, l->param, l->param_type);
+        Type body_type = std::visit(*this, l->body);
         return make_arrow(l->param_type, body_type);
     }
     
     Type operator()(const std::shared_ptr<Apply>& a) {
-        Type func_type = infer_type(a->func, context);
-        Type arg_type = infer_type(a->arg, context);
+        Type func_type = std::visit(*this, a->func);
+        Type arg_type = std::visit(*this, a->arg);
         Type result_type = make_typevar();
         
         try {
-            unify(func_type, make_arrow(arg_type, result_type), substitutions);
-            auto apply_subs = [&](Type t) -> Type {
-                if (auto tv = std::get_if<std::shared_ptr<TypeVar>>(&t)) {
-                    auto it = substitutions.find((*tv)->id);
-                    if (it != substitutions.end()) return apply_all_subs(it->second);
-                } else if (auto ta = std::get_if<std::shared_ptr<TypeArrow>>(&t)) {
-                    return make_arrow(apply_all_subs((*ta)->from), apply_all_subs((*ta)->to));
-                }
-                return t;
-            };
-            
-            return apply_subs(result_type); 
-            
+            // Ожидаемая стрелка становится значением переменной и попадает в тип
+            // результата, поэтому тоже интернируется
+            session.unify(func_type, make_arrow(arg_type, result_type));
+            return result_type;
         } catch (const std::runtime_error& e) {
             throw std::runtime_error("Type error in application: " + std::string(e.what()) + 
                    "\nFunction type: " + type_to_string_full(func_type) +
@@ -185,25 +307,130 @@ struct InferVisitor {
     }
 };
 
-Type infer_type(Expr expr, TypeContext& context) {
-    InferVisitor visitor{context};
-    Type result = std::visit(visitor, expr);
+TypeInference::TypeInference(TypeContext& context, bool keep_bindings)
+    : context(context), keep_bindings(keep_bindings) {}
+
+void TypeInference::unify(Type t1, Type t2) {
+    unify_types(t1, t2, &journal);
+}
+
+Type TypeInference::find(Type type) {
+    return find_root(type, &journal);
+}
+
+template <typename Infer>
+Type TypeInference::run(Infer infer) {
+    size_t mark = journal.bindings.size();
+    journal.first_fresh = TypeVarGenerator::created();
+    try {
+        // Сжатие путей при построении типа тоже журналируется: иначе откат
+        // оставил бы переменные, сжатые к связям этого вывода
+        Type type = resolve_root(infer(), &journal);
+        // Связи удачного вывода остаются в сеансе или откатываются,
+        // если вывод не должен менять переменные снаружи
+        if (keep_bindings) journal.bindings.resize(mark);
+        else rollback(mark);
+        journal.first_fresh = 0;
+        return type;
+    } catch (...) {
+        rollback(mark);
+        journal.first_fresh = 0;
+        throw;
+    }
+}
+
+Type TypeInference::infer(const Expr& expr) {
+    return run([&] {
+        InferVisitor visitor{*this, context};
+        return std::visit(visitor, expr);
+    });
+}
+
+// Вывод типа безымянного выражения: типы связанных переменных — стек,
+// индекс де Брёйна отсчитывается от его вершины
+struct LnInferVisitor {
+    TypeInference& session;
+    const LnTypeContext& free_context;
+    std::vector<Type> bound;
     
-    std::function<Type(Type)> apply_all_subs = [&](Type t) -> Type {
-        if (auto tv = std::get_if<std::shared_ptr<TypeVar>>(&t)) {
-            auto it = visitor.substitutions.find((*tv)->id);
-            if (it != visitor.substitutions.end()) return apply_all_subs(it->second);
-        } else if (auto ta = std::get_if<std::shared_ptr<TypeArrow>>(&t)) {
-            return make_arrow(apply_all_subs((*ta)->from), apply_all_subs((*ta)->to));
+    Type operator()(const LnExpr& expr) {
+        switch (expr->kind) {
+            case LnNode::BOUND:
+                return bound[bound.size() - 1 - expr->index];
+            case LnNode::FREE: {
+                auto it = free_context.find(expr->index);
+                if (it == free_context.end()) {
+                    throw std::runtime_error("Unbound variable: " + name_of(expr->index));
+                }
+                return it->second;
+            }
+            case LnNode::CONST:
+                return expr->type;
+            case LnNode::LAMBDA: {
+                bound.push_back(expr->type);
+                Type body_type = (*this)(expr->left);
+                bound.pop_back();
+                return make_arrow(expr->type, body_type);
+            }
+            case LnNode::APPLY: {
+                Type func_type = (*this)(expr->left);
+                Type arg_type = (*this)(expr->right);
+                Type result_type = make_typevar();
+                try {
+                    session.unify(func_type, make_arrow(arg_type, result_type));
+                    return result_type;
+                } catch (const std::runtime_error& e) {
+                    throw std::runtime_error("Type error in application: " + std::string(e.what()) + 
+                           "\nFunction type: " + type_to_string_full(func_type) +
+                           "\nArgument type: " + type_to_string_full(arg_type));
+                }
+            }
         }
-        return t;
-    };
-    
-    return apply_all_subs(result);
+        throw std::logic_error("Unknown locally nameless node");
+    }
+};
+
+Type TypeInference::infer(const LnExpr& expr, const LnTypeContext& free_context) {
+    return run([&] {
+        LnInferVisitor visitor{*this, free_context, {}};
+        return visitor(expr);
+    });
+}
+
+void TypeInference::rollback(size_t mark) {
+    while (journal.bindings.size() > mark) {
+        TypeBinding& binding = journal.bindings.back();
+        binding.var->instance = std::move(binding.previous);
+        journal.bindings.pop_back();
+    }
+}
+
+Type infer_type(Expr expr, TypeContext& context) {
+    return TypeInference(context, false).infer(expr);
 }
 
 // Подстановка переменной в выражении
-Expr substitute(Expr expr, const std::string& var, Expr value) {
+// Бит имени считается один раз на вызов и передаётся вниз по рекурсии
+static bool occurs_free(const Expr& expr, const std::string& var, uint64_t bit) {
+    if (!(free_mask(expr) & bit)) return false;
+    if (auto v = std::get_if<std::shared_ptr<Variable>>(&expr)) return (*v)->name == var;
+    if (auto l = std::get_if<std::shared_ptr<Lambda>>(&expr)) {
+        return (*l)->param != var && occurs_free((*l)->body, var, bit);
+    }
+    if (auto a = std::get_if<std::shared_ptr<Apply>>(&expr)) {
+        return occurs_free((*a)->func, var, bit) || occurs_free((*a)->arg, var, bit);
+    }
+    return false;
+}
+
+bool occurs_free(const Expr& expr, const std::string& var) {
+    return occurs_free(expr, var, name_bit(var));
+}
+
+static Expr substitute(const Expr& expr, const std::string& var, uint64_t bit, const Expr& value) {
+    // Переменной нет в поддереве — узел возвращается как есть и остаётся общим
+    if (!(free_mask(expr) & bit)) return expr;
+    
     if (auto v = std::get_if<std::shared_ptr<Variable>>(&expr)) {
         if ((*v)->name == var) {
             return value;
@@ -215,19 +442,34 @@ Expr substitute(Expr expr, const std::string& var, Expr value) {
         if ((*l)->param == var) {
             return expr; // Связанная переменная
         }
-        return make_lambda((*l)->param, (*l)->param_type, substitute((*l)->body, var, value));
+        // Отдельного прохода по телу нет: при ложном срабатывании маски
+        // неизменённое тело вернётся тем же указателем, и value не проверяется
+        Expr new_body = substitute((*l)->body, var, bit, value);
+        if (new_body == (*l)->body) return expr;
+        if (!occurs_free(value, (*l)->param)) return make_lambda((*l)->param, (*l)->param_type, new_body);
+        
+        // Параметр захватил бы свободную переменную value: переименование
+        // и подстановка заново в переименованное тело
+        std::string fresh = (*l)->param + "'";
+        while (occurs_free(value, fresh) || occurs_free((*l)->body, fresh)) fresh += "'";
+        Expr body = substitute((*l)->body, (*l)->param, make_variable(fresh, (*l)->param_type));
+        return make_lambda(fresh, (*l)->param_type, substitute(body, var, bit, value));
     }
     
     if (auto a = std::get_if<std::shared_ptr<Apply>>(&expr)) {
-        return make_apply(
-            substitute((*a)->func, var, value),
-            substitute((*a)->arg, var, value)
-        );
+        Expr func = substitute((*a)->func, var, bit, value);
+        Expr arg = substitute((*a)->arg, var, bit, value);
+        if (func == (*a)->func && arg == (*a)->arg) return expr;
+        return make_apply(func, arg);
     }
     
     return expr; // Для констант
 }
 
+Expr substitute(Expr expr, const std::string& var, Expr value) {
+    return substitute(expr, var, name_bit(var), value);
+}
+
 // Редукция выражения 
 std::pair<Expr, bool> reduce(Expr expr) {
     if (auto a = std::get_if<std::shared_ptr<Apply>>(&expr)) {
@@ -260,6 +502,356 @@ Expr normalize(Expr expr) {
     return current;
 }
 
+// Нормализация вычислением: выражение вычисляется в семантические значения
+// (замыкания и нейтральные термы), затем значение читается обратно в выражение.
+// Аргументы вычисляются лениво и не более одного раза, поэтому нормальная форма
+// находится для тех же термов, что и при нормальном порядке редукции
+struct SemanticValue;
+struct Thunk;
+struct EnvNode;
+using ValuePtr = std::shared_ptr<SemanticValue>;
+using ThunkPtr = std::shared_ptr<Thunk>;
+using Env = std::shared_ptr<const EnvNode>;
+
+// Окружение — неизменяемый список: расширение O(1), хвост разделяется замыканиями
+struct EnvNode {
+    std::string name;
+    ThunkPtr value;
+    Env next;
+};
+
+struct SemanticValue {
+    enum Kind { CLOSURE, NEUTRAL_HEAD, NEUTRAL_APPLY };
+    Kind kind;
+    std::shared_ptr<Lambda> lambda;   // CLOSURE
+    Env env;                          // CLOSURE
+    Expr head;                        // NEUTRAL_HEAD: свободная переменная или константа
+    ValuePtr func;                    // NEUTRAL_APPLY
+    ThunkPtr arg;                     // NEUTRAL_APPLY
+};
+
+struct Thunk {
+    Expr expr;
+    Env env;
+    ValuePtr value;   // после вычисления выражение и окружение отпускаются
+};
+
+static ValuePtr eval(const Expr& expr, const Env& env);
+
+static ValuePtr force(const ThunkPtr& thunk) {
+    if (!thunk->value) {
+        thunk->value = eval(thunk->expr, thunk->env);
+        thunk->env.reset();
+    }
+    return thunk->value;
+}
+
+static ValuePtr neutral(Expr head) {
+    return std::make_shared<SemanticValue>(SemanticValue{SemanticValue::NEUTRAL_HEAD, nullptr, nullptr, std::move(head), nullptr, nullptr});
+}
+
+static ValuePtr apply_value(const ValuePtr& func, ThunkPtr arg) {
+    if (func->kind == SemanticValue::CLOSURE) {
+        Env env = std::make_shared<const EnvNode>(EnvNode{func->lambda->param, std::move(arg), func->env});
+        return eval(func->lambda->body, env);
+    }
+    return std::make_shared<SemanticValue>(SemanticValue{SemanticValue::NEUTRAL_APPLY, nullptr, nullptr, {}, func, std::move(arg)});
+}
+
+static ValuePtr eval(const Expr& expr, const Env& env) {
+    if (auto v = std::get_if<std::shared_ptr<Variable>>(&expr)) {
+        for (const EnvNode* node = env.get(); node; node = node->next.get()) {
+            if (node->name == (*v)->name) return force(node->value);
+        }
+        return neutral(expr);
+    }
+    if (auto l = std::get_if<std::shared_ptr<Lambda>>(&expr)) {
+        return std::make_shared<SemanticValue>(SemanticValue{SemanticValue::CLOSURE, *l, env, {}, nullptr, nullptr});
+    }
+    if (auto a = std::get_if<std::shared_ptr<Apply>>(&expr)) {
+        ValuePtr func = eval((*a)->func, env);
+        // Аргумент-переменная разделяет уже существующий thunk окружения
+        ThunkPtr arg;
+        if (auto v = std::get_if<std::shared_ptr<Variable>>(&(*a)->arg)) {
+            for (const EnvNode* node = env.get(); node && !arg; node = node->next.get()) {
+                if (node->name == (*v)->name) arg = node->value;
+            }
+        }
+        if (!arg) arg = std::make_shared<Thunk>(Thunk{(*a)->arg, env, nullptr});
+        return apply_value(func, std::move(arg));
+    }
+    return neutral(expr);
+}
+
+// Обратное чтение: параметры лямбд получают имена, не совпадающие
+// со свободными переменными терма и с параметрами объемлющих лямбд
+struct Readback {
+    std::unordered_map<std::string, int> taken;
+    
+    std::string fresh(const std::string& base) {
+        std::string name = base;
+        for (int i = 1; taken.count(name); ++i) name = base + std::to_string(i);
+        return name;
+    }
+    
+    Expr operator()(const ValuePtr& value) {
+        switch (value->kind) {
+            case SemanticValue::NEUTRAL_HEAD:
+                return value->head;
+            case SemanticValue::NEUTRAL_APPLY:
+                return make_apply((*this)(value->func), (*this)(force(value->arg)));
+            case SemanticValue::CLOSURE: {
+                const std::shared_ptr<Lambda>& lambda = value->lambda;
+                std::string name = fresh(lambda->param);
+                Expr var = make_variable(name, lambda->param_type);
+                ValuePtr body = apply_value(value, std::make_shared<Thunk>(Thunk{var, nullptr, neutral(var)}));
+                ++taken[name];
+                Expr body_expr = (*this)(body);
+                if (--taken[name] == 0) taken.erase(name);
+                return make_lambda(name, lambda->param_type, body_expr);
+            }
+        }
+        throw std::logic_error("Unknown semantic value");
+    }
+};
+
+static void collect_free(const Expr& expr, std::unordered_map<std::string, int>& bound,
+                         std::unordered_map<std::string, int>& free) {
+    if (auto v = std::get_if<std::shared_ptr<Variable>>(&expr)) {
+        if (!bound.count((*v)->name)) free[(*v)->name] = 1;
+    } else if (auto l = std::get_if<std::shared_ptr<Lambda>>(&expr)) {
+        ++bound[(*l)->param];
+        collect_free((*l)->body, bound, free);
+        if (--bound[(*l)->param] == 0) bound.erase((*l)->param);
+    } else if (auto a = std::get_if<std::shared_ptr<Apply>>(&expr)) {
+        collect_free((*a)->func, bound, free);
+        collect_free((*a)->arg, bound, free);
+    }
+}
+
+Expr normalize_nbe(Expr expr) {
+    Readback readback;
+    std::unordered_map<std::string, int> bound;
+    collect_free(expr, bound, readback.taken);
+    return readback(eval(expr, nullptr));
+}
+
+// Безымянное представление
+static std::vector<std::string>& name_table() {
+    static std::vector<std::string> names;
+    return names;
+}
+
+int name_id(const std::string& name) {
+    static std::unordered_map<std::string, int> ids;
+    auto [it, inserted] = ids.try_emplace(name, static_cast<int>(name_table().size()));
+    if (inserted) name_table().push_back(name);
+    return it->second;
+}
+
+const std::string& name_of(int id) {
+    return name_table()[id];
+}
+
+static uint64_t id_bit(int id) {
+    return uint64_t(1) << (id & 63);
+}
+
+LnExpr ln_bound(int index, Type type) {
+    return std::make_shared<const LnNode>(LnNode{LnNode::BOUND, index, type, nullptr, nullptr, index + 1, 0});
+}
+
+LnExpr ln_free(int name, Type type) {
+    return std::make_shared<const LnNode>(LnNode{LnNode::FREE, name, type, nullptr, nullptr, 0, id_bit(name)});
+}
+
+LnExpr ln_const(int name, Type type) {
+    return std::make_shared<const LnNode>(LnNode{LnNode::CONST, name, type, nullptr, nullptr, 0, 0});
+}
+
+LnExpr ln_lambda(int hint, Type param_type, LnExpr body) {
+    int loose = std::max(0, body->loose - 1);
+    uint64_t mask = body->free_mask;
+    return std::make_shared<const LnNode>(LnNode{LnNode::LAMBDA, hint, param_type, std::move(body), nullptr, loose, mask});
+}
+
+LnExpr ln_apply(LnExpr func, LnExpr arg) {
+    int loose = std::max(func->loose, arg->loose);
+    uint64_t mask = func->free_mask | arg->free_mask;
+    return std::make_shared<const LnNode>(LnNode{LnNode::APPLY, 0, Type{}, std::move(func), std::move(arg), loose, mask});
+}
+
+static LnExpr to_locally_nameless(const Expr& expr, std::vector<std::string>& scope) {
+    if (auto v = std::get_if<std::shared_ptr<Variable>>(&expr)) {
+        for (size_t i = scope.size(); i-- > 0;) {
+            if (scope[i] == (*v)->name) return ln_bound(static_cast<int>(scope.size() - 1 - i), (*v)->type);
+        }
+        return ln_free(name_id((*v)->name), (*v)->type);
+    }
+    if (auto c = std::get_if<std::shared_ptr<Constant>>(&expr)) {
+        return ln_const(name_id((*c)->name), (*c)->type);
+    }
+    if (auto l = std::get_if<std::shared_ptr<Lambda>>(&expr)) {
+        scope.push_back((*l)->param);
+        LnExpr body = to_locally_nameless((*l)->body, scope);
+        scope.pop_back();
+        return ln_lambda(name_id((*l)->param), (*l)->param_type, body);
+    }
+    auto a = std::get<std::shared_ptr<Apply>>(expr);
+    return ln_apply(to_locally_nameless(a->func, scope), to_locally_nameless(a->arg, scope));
+}
+
+LnExpr to_locally_nameless(const Expr& expr) {
+    std::vector<std::string> scope;
+    return to_locally_nameless(expr, scope);
+}
+
+static void collect_free_names(const LnExpr& expr, std::unordered_map<std::string, int>& names) {
+    if (!expr->free_mask) return;
+    if (expr->kind == LnNode::FREE) names[name_of(expr->index)] = 1;
+    if (expr->left) collect_free_names(expr->left, names);
+    if (expr->right) collect_free_names(expr->right, names);
+}
+
+static Expr to_named(const LnExpr& expr, std::vector<std::string>& scope, std::unordered_map<std::string, int>& taken) {
+    switch (expr->kind) {
+        case LnNode::BOUND:
+            return make_variable(scope[scope.size() - 1 - expr->index], expr->type);
+        case LnNode::FREE:
+            return make_variable(name_of(expr->index), expr->type);
+        case LnNode::CONST:
+            return make_constant(name_of(expr->index), expr->type);
+        case LnNode::LAMBDA: {
+            std::string name = name_of(expr->index);
+            while (taken.count(name)) name += "'";
+            scope.push_back(name);
+            ++taken[name];
+            Expr body = to_named(expr->left, scope, taken);
+            if (--taken[name] == 0) taken.erase(name);
+            scope.pop_back();
+            return make_lambda(name, expr->type, body);
+        }
+        case LnNode::APPLY:
+            return make_apply(to_named(expr->left, scope, taken), to_named(expr->right, scope, taken));
+    }
+    throw std::logic_error("Unknown locally nameless node");
+}
+
+Expr to_named(const LnExpr& expr) {
+    std::vector<std::string> scope;
+    std::unordered_map<std::string, int> taken;
+    collect_free_names(expr, taken);
+    return to_named(expr, scope, taken);
+}
+
+LnTypeContext to_ln_context(const TypeContext& context) {
+    LnTypeContext result;
+    for (const auto& [name, type] : context) result[name_id(name)] = type;
+    return result;
+}
+
+// Узлы без затронутых индексов или имён возвращаются как есть и остаются общими
+LnExpr ln_shift(const LnExpr& expr, int d, int cutoff) {
+    if (d == 0 || expr->loose <= cutoff) return expr;
+    switch (expr->kind) {
+        case LnNode::BOUND:
+            return ln_bound(expr->index + d, expr->type);
+        case LnNode::LAMBDA: {
+            LnExpr body = ln_shift(expr->left, d, cutoff + 1);
+            return body == expr->left ? expr : ln_lambda(expr->index, expr->type, body);
+        }
+        case LnNode::APPLY: {
+            LnExpr func = ln_shift(expr->left, d, cutoff);
+            LnExpr arg = ln_shift(expr->right, d, cutoff);
+            return func == expr->left && arg == expr->right ? expr : ln_apply(func, arg);
+        }
+        default:
+            return expr;
+    }
+}
+
+// Индекс depth заменяется аргументом, сдвинутым под depth лямбд,
+// большие индексы уменьшаются: лямбда, которая их связывала, исчезла
+static LnExpr instantiate(const LnExpr& expr, int depth, const LnExpr& arg) {
+    if (expr->loose <= depth) return expr;
+    switch (expr->kind) {
+        case LnNode::BOUND:
+            if (expr->index == depth) return ln_shift(arg, depth);
+            return ln_bound(expr->index - 1, expr->type);
+        case LnNode::LAMBDA: {
+            LnExpr body = instantiate(expr->left, depth + 1, arg);
+            return body == expr->left ? expr : ln_lambda(expr->index, expr->type, body);
+        }
+        case LnNode::APPLY: {
+            LnExpr func = instantiate(expr->left, depth, arg);
+            LnExpr value = instantiate(expr->right, depth, arg);
+            return func == expr->left && value == expr->right ? expr : ln_apply(func, value);
+        }
+        default:
+            return expr;
+    }
+}
+
+LnExpr ln_instantiate(const LnExpr& body, const LnExpr& arg) {
+    return instantiate(body, 0, arg);
+}
+
+static LnExpr substitute_free(const LnExpr& expr, int name, const LnExpr& value, int depth) {
+    if (!(expr->free_mask & id_bit(name))) return expr;
+    switch (expr->kind) {
+        case LnNode::FREE:
+            return expr->index == name ? ln_shift(value, depth) : expr;
+        case LnNode::LAMBDA: {
+            LnExpr body = substitute_free(expr->left, name, value, depth + 1);
+            return body == expr->left ? expr : ln_lambda(expr->index, expr->type, body);
+        }
+        case LnNode::APPLY: {
+            LnExpr func = substitute_free(expr->left, name, value, depth);
+            LnExpr arg = substitute_free(expr->right, name, value, depth);
+            return func == expr->left && arg == expr->right ? expr : ln_apply(func, arg);
+        }
+        default:
+            return expr;
+    }
+}
+
+LnExpr ln_substitute(const LnExpr& expr, int name, const LnExpr& value) {
+    return substitute_free(expr, name, value, 0);
+}
+
+std::pair<LnExpr, bool> ln_reduce(const LnExpr& expr) {
+    if (expr->kind == LnNode::APPLY) {
+        auto [new_func, reduced] = ln_reduce(expr->left);
+        if (reduced) {
+            return {ln_apply(new_func, expr->right), true};
+        }
+        
+        if (new_func->kind == LnNode::LAMBDA) {
+            return {ln_instantiate(new_func->left, expr->right), true};
+        }
+        
+        auto [new_arg, arg_reduced] = ln_reduce(expr->right);
+        if (arg_reduced) {
+            return {ln_apply(expr->left, new_arg), true};
+        }
+    }
+    
+    return {expr, false};
+}
+
+LnExpr ln_normalize(LnExpr expr) {
+    bool reduced;
+    do {
+        std::tie(expr, reduced) = ln_reduce(expr);
+    } while (reduced);
+    return expr;
+}
+
+Type ln_infer_type(const LnExpr& expr, const LnTypeContext& free_context) {
+    TypeContext unused;
+    return TypeInference(unused, false).infer(expr, free_context);
+}
+
 // Вывод выражения
 void print_expr(const Expr& expr) {
     if (auto c = std::get_if<std::shared_ptr<Constant>>(&expr)) {
@@ -279,11 +871,8 @@ void print_expr(const Expr& expr) {
 }
 
 struct FullTypePrinter {
-    std::unordered_map<int, Type> var_types;
-    
     std::string operator()(const std::shared_ptr<TypeVar>& tv) {
-        auto it = var_types.find(tv->id);
-        if (it != var_types.end()) return type_to_string_full(it->second);
+        if (tv->instance) return type_to_string_full(*tv->instance);
         return "?" + std::to_string(tv->id);
     }
     
@@ -5,7 +5,10 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <optional>
+#include <vector>
 #include <utility>
+#include <cstdint>
 
 
 // Типы в системе
@@ -19,8 +22,13 @@ using Type = std::variant<
     std::shared_ptr<TypeConst>
 >;
 
+// Переменная типа — узел системы непересекающихся множеств:
+// instance указывает на представителя класса или на тип, с которым она унифицирована
 struct TypeVar {
     int id;
+    uint64_t serial;    // порядковый номер создания: не зависит от id и не сбрасывается reset()
+    int rank = 0;
+    std::optional<Type> instance;
     explicit TypeVar(int i);
 };
 
@@ -40,15 +48,22 @@ class TypeVarGenerator {
     static int counter;
 public:
     static int next();
+    static int peek();
     static void reset();
+    // Число переменных, созданных за всё время работы (следующий serial)
+    static uint64_t created();
 };
 
-// Функции для создания типов
+// Функции для создания типов; стрелки и константы интернируются,
+// переменные всегда новые: они изменяемы при унификации
 Type make_typevar();
 Type make_typevar(int id);
 Type make_arrow(Type from, Type to);
 Type make_typeconst(const std::string& name);
 
+// Число записей в таблицах интернирования
+size_t interned_types();
+
 // Вывод типа в строку
 std::string type_to_string_full(Type type); 
 
@@ -71,9 +86,13 @@ struct Constant {
     explicit Constant(const std::string& n, Type t);
 };
 
+// free_mask — битовая маска свободных переменных узла (бит на хэш имени).
+// Маска может содержать лишние биты, но не теряет нужных: если бита
+// переменной нет, переменная в поддереве свободно не встречается
 struct Variable {
     std::string name;
     Type type;
+    uint64_t free_mask;
     explicit Variable(const std::string& n, Type t);
 };
 
@@ -81,12 +100,14 @@ struct Lambda {
     std::string param;
     Type param_type;
     Expr body;
+    uint64_t free_mask;
     Lambda(const std::string& p, Type pt, Expr b);
 };
 
 struct Apply {
     Expr func;
     Expr arg;
+    uint64_t free_mask;
     Apply(Expr f, Expr a);
 };
 
@@ -99,13 +120,71 @@ Expr make_variable(const std::string& name, Type type);
 Expr make_lambda(const std::string& param, Type param_type, Expr body);
 Expr make_apply(Expr func, Expr arg);
 
-// Унификация типов
-void unify(Type t1, Type t2, std::unordered_map<int, Type>& substitutions);
+// Унификация типов: связывает переменные на месте
+void unify(Type t1, Type t2);
+
+// Представитель типа: связанные переменные пропускаются со сжатием путей
+Type find_type(Type type);
+
+// Тип без связанных переменных
+Type resolve_type(Type type);
+
+// Отменяемое изменение переменной типа
+struct TypeBinding {
+    std::shared_ptr<TypeVar> var;
+    std::optional<Type> previous;
+};
+
+// Журнал вывода: переменные с serial от first_fresh созданы самим выводом,
+// снаружи их не видно, и их связи при откате не восстанавливаются
+struct TypeJournal {
+    std::vector<TypeBinding> bindings;
+    uint64_t first_fresh = 0;
+};
+
+// Безымянное представление выражений (см. LnNode ниже)
+struct LnNode;
+using LnExpr = std::shared_ptr<const LnNode>;
+// Контекст свободных переменных безымянного представления: номер имени — тип
+using LnTypeContext = std::unordered_map<int, Type>;
+
+// Сеанс вывода типов: одно хранилище связей (узлы TypeVar) на весь терм
+// и на все выводы сеанса. Изменения переменных во время вывода записываются
+// в журнал; если вывод терма не удался, его связи откатываются.
+// С keep_bindings = false откатываются и связи удачного вывода: переменные,
+// существовавшие до вывода, остаются как были
+class TypeInference {
+public:
+    explicit TypeInference(TypeContext& context, bool keep_bindings = true);
+    
+    Type infer(const Expr& expr);
+    // Связанные переменные — по индексу в стеке типов, свободные — из free_context
+    Type infer(const LnExpr& expr, const LnTypeContext& free_context);
+    void unify(Type t1, Type t2);
+    Type find(Type type);
+    
+private:
+    TypeContext& context;
+    TypeJournal journal;
+    bool keep_bindings;
+    
+    template <typename Infer>
+    Type run(Infer infer);
+    void rollback(size_t mark);
+};
 
-// Вывод типа выражения
+// Вывод типа выражения в отдельном сеансе, не меняющем переменные снаружи
 Type infer_type(Expr expr, TypeContext& context);
 
-// Подстановка переменной в выражении
+// Бит имени в масках свободных переменных
+uint64_t name_bit(const std::string& name);
+uint64_t free_mask(const Expr& expr);
+
+// Встречается ли переменная свободно в выражении
+bool occurs_free(const Expr& expr, const std::string& var);
+
+// Подстановка переменной в выражении без захвата: связанные переменные,
+// свободные в value, переименовываются; поддеревья без var не копируются
 Expr substitute(Expr expr, const std::string& var, Expr value);
 
 // Редукция выражения 
@@ -114,19 +193,52 @@ std::pair<Expr, bool> reduce(Expr expr);
 // Полная нормальная форма
 Expr normalize(Expr expr);
 
+// Нормальная форма вычислением в семантические значения и обратным чтением;
+// в отличие от normalize редуцирует и под лямбдами
+Expr normalize_nbe(Expr expr);
+
+// Безымянное (locally nameless) представление: связанные переменные — индексы
+// де Брёйна, свободные переменные и константы — номера в общей таблице имён.
+// Подстановка, редукция и вывод типа сравнивают целые числа вместо строк
+struct LnNode {
+    enum Kind { BOUND, FREE, CONST, LAMBDA, APPLY };
+    Kind kind;
+    int index;          // BOUND: индекс де Брёйна; FREE, CONST, LAMBDA: номер имени (у лямбды — подсказка для печати)
+    Type type;          // тип переменной или константы, у лямбды — тип параметра
+    LnExpr left;        // тело лямбды или функция применения
+    LnExpr right;       // аргумент применения
+    int loose;          // на единицу больше наибольшего индекса, не связанного внутри узла
+    uint64_t free_mask; // маска номеров свободных переменных, как free_mask у Expr
+};
+
+// Общая таблица имён
+int name_id(const std::string& name);
+const std::string& name_of(int id);
+
+LnExpr ln_bound(int index, Type type);
+LnExpr ln_free(int name, Type type);
+LnExpr ln_const(int name, Type type);
+LnExpr ln_lambda(int hint, Type param_type, LnExpr body);
+LnExpr ln_apply(LnExpr func, LnExpr arg);
+
+// Перевод из именованной формы и обратно; при обратном переводе
+// параметры, совпадающие со свободными или объемлющими именами, получают штрихи
+LnExpr to_locally_nameless(const Expr& expr);
+Expr to_named(const LnExpr& expr);
+LnTypeContext to_ln_context(const TypeContext& context);
+
+// Сдвиг индексов не меньше cutoff на d
+LnExpr ln_shift(const LnExpr& expr, int d, int cutoff = 0);
+// Тело лямбды с подставленным вместо её параметра аргументом
+LnExpr ln_instantiate(const LnExpr& body, const LnExpr& arg);
+// Подстановка вместо свободной переменной
+LnExpr ln_substitute(const LnExpr& expr, int name, const LnExpr& value);
+// Тот же порядок редукции, что у reduce и normalize
+std::pair<LnExpr, bool> ln_reduce(const LnExpr& expr);
+LnExpr ln_normalize(LnExpr expr);
+Type ln_infer_type(const LnExpr& expr, const LnTypeContext& free_context);
+
 // Вывод выражения в читаемом виде
 void print_expr(const Expr& expr);
 
-struct UnifyVisitor {
-    Type t2;
-    std::unordered_map<int, Type>& substitutions;
-    
-    UnifyVisitor(Type t2, std::unordered_map<int, Type>& subs, int d = 0)
-        : t2(t2), substitutions(subs) {}
-    
-    void operator()(const std::shared_ptr<TypeVar>& tv1);
-    void operator()(const std::shared_ptr<TypeArrow>& ta1);
-    void operator()(const std::shared_ptr<TypeConst>& tc1);
-};
-
 #endif 
\ No newline at end of file
@@ -7,310 +7,544 @@
 #include <variant>
 #include <functional>
 #include <map>
+#include <unordered_map>
+#include <stdexcept>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <new>
+#include <filesystem>
 
-// === Базовые структуры данных ===
-struct Term;
-using TermPtr = std::shared_ptr<Term>;
-
-struct Term {
-    enum Type { EMPTY, ATOM, PAIR, CLOSURE, NUMBER, QUOTE };
-    Type type;
-    
-    // Значения
-    std::string atom_value;
-    int number_value;
-    TermPtr first;
-    TermPtr second;
-    std::vector<std::string> closure_code;
-    TermPtr closure_env;
-    TermPtr quoted_term;
-    
-    // Конструкторы
-    Term(Type t) : type(t) {}
-    Term(const std::string& value) : type(ATOM), atom_value(value) {}
-    Term(int value) : type(NUMBER), number_value(value) {}
-    Term(TermPtr f, TermPtr s) : type(PAIR), first(f), second(s) {}
-    Term(const std::vector<std::string>& code, TermPtr env) 
-        : type(CLOSURE), closure_code(code), closure_env(env) {}
-    Term(TermPtr term) : type(QUOTE), quoted_term(term) {}
-    
-    std::string toString() const {
-        switch (type) {
-            case EMPTY: return "()";
-            case ATOM: return atom_value;
-            case NUMBER: return std::to_string(number_value);
-            case PAIR: return "[" + first->toString() + ", " + second->toString() + "]";
-            case CLOSURE: return "Λ(" + std::to_string(closure_code.size()) + ")";
-            case QUOTE: return "'" + quoted_term->toString();
-            default: return "unknown";
-        }
-    }
-};
-
-// Фабричные функции
-TermPtr make_empty() { return std::make_shared<Term>(Term::EMPTY); }
-TermPtr make_atom(const std::string& name) { return std::make_shared<Term>(name); }
-TermPtr make_number(int value) { return std::make_shared<Term>(value); }
-TermPtr make_pair(TermPtr first, TermPtr second) { return std::make_shared<Term>(first, second); }
-TermPtr make_closure(const std::vector<std::string>& code, TermPtr env) { 
-    return std::make_shared<Term>(code, env); 
+#include "cam2.hpp"
+
+using namespace cam2;
+
+// === Тесты ===
+// Счётчик обращений к куче C++: замена глобального operator new для проверки,
+// что шаги машины не выделяют память (ячейки термов берутся из блоков CellHeap)
+size_t heap_allocations = 0;
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    ++heap_allocations;
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* ptr) noexcept { std::free(ptr); }
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void test_kam_basic() {
+    std::cout << "=== Базовый тест КАМ: 2 + 3 ===" << std::endl;
+    
+    BasicCAMMachine<PrintTrace> machine(make_empty(), assemble("push 2 push 3 add"));
+    machine.run();
+    std::cout << "Результат: " << machine.getResult().toString() << std::endl;
+}
+
+void test_kam_simple_closure() {
+    std::cout << "=== Простое замыкание: const 5 ===" << std::endl;
+    
+    // Замыкание, которое всегда возвращает 5; 999 — любой аргумент
+    BasicCAMMachine<PrintTrace> machine(make_empty(), assemble("cur { push 5 } push 999 cons app"));
+    machine.run();
+    std::cout << "Результат: " << machine.getResult().toString() << std::endl;
+}
+
+void test_kam_identity() {
+    std::cout << "=== Тождественное замыкание ===" << std::endl;
+    
+    // Замыкание, которое возвращает свой аргумент
+    BasicCAMMachine<PrintTrace> machine(make_empty(), assemble("cur { access[0] } push 42 cons app"));
+    machine.run();
+    std::cout << "Результат: " << machine.getResult().toString() << std::endl;
+}
+
+// Церковская цифра n = λf.λx. f (f … (f x))
+DbTermPtr church(int n) {
+    DbTermPtr body = db_var(0);
+    for (int i = 0; i < n; ++i) body = db_app(db_var(1), body);
+    return db_abs(db_abs(body));
+}
+
+// Результат печатается, пока жива машина: замыкание ссылается на её код и ячейки кучи
+template <typename Trace = NoTrace>
+std::string run_compiled(const DbTermPtr& term, EnvMode mode = EnvMode::NESTED) {
+    BasicCAMMachine<Trace> machine(make_empty(), compile(term));
+    machine.setEnvMode(mode);
+    machine.run();
+    return machine.getResult().toString();
+}
+
+void test_compile() {
+    std::cout << "=== Компиляция лямбда-термов ===" << std::endl;
+    
+    // (λ.0) 42
+    DbTermPtr identity = db_app(db_abs(db_var(0)), db_num(42));
+    std::cout << "(λ.0) 42 → " << disassemble(compile(identity)) << std::endl;
+    run_compiled<PrintTrace>(identity);
+    
+    // ((λ.λ.1) 5) 7 = 5: доступ через один уровень окружения
+    DbTermPtr k = db_app(db_app(db_abs(db_abs(db_var(1))), db_num(5)), db_num(7));
+    std::cout << "K 5 7 = " << run_compiled(k) << std::endl;
+    
+    // λ.λ.λ.2 применённая к 1 2 3: цепочка car car cdr сворачивается в access[2]
+    DbTermPtr select = db_abs(db_abs(db_abs(db_var(2))));
+    DbTermPtr first = db_app(db_app(db_app(select, db_num(1)), db_num(2)), db_num(3));
+    std::cout << "(λλλ.2) 1 2 3 = " << run_compiled(first) << std::endl;
+    
+    // 3 (λ.0) 9 = 9 и (2 3) (λ.0) 11 = 11
+    std::cout << "3 I 9 = "
+              << run_compiled(db_app(db_app(church(3), db_abs(db_var(0))), db_num(9))) << std::endl;
+    DbTermPtr power = db_app(db_app(db_app(church(2), church(3)), db_abs(db_var(0))), db_num(11));
+    std::cout << "3^2 I 11 = " << run_compiled(power) << std::endl;
 }
-TermPtr make_quote(TermPtr term) { return std::make_shared<Term>(term); }
-
-// === Инструкции КАМ ===
-struct Instruction {
-    enum Type { 
-        PUSH, SWAP, CONS, 
-        CAR, CDR, 
-        QUOTE, 
-        CUR, APP,
-        ACCESS
-    };
-    
-    Type type;
-    TermPtr term;
-    std::vector<std::string> code;
-    int index;
-    
-    Instruction(Type t) : type(t), term(nullptr), index(-1) {}
-    Instruction(Type t, TermPtr term) : type(t), term(term), index(-1) {}
-    Instruction(Type t, const std::vector<std::string>& code) : type(t), code(code), index(-1) {}
-    Instruction(Type t, int index) : type(t), term(nullptr), index(index) {}
-    
-    std::string toString() const {
-        switch (type) {
-            case PUSH: return "push" + (term ? " " + term->toString() : "");
-            case SWAP: return "swap";
-            case CONS: return "cons";
-            case CAR: return "car";
-            case CDR: return "cdr";
-            case QUOTE: return "quote" + (term ? " " + term->toString() : "");
-            case CUR: return "cur";
-            case APP: return "app";
-            case ACCESS: return "access[" + std::to_string(index) + "]";
-            default: return "unknown";
+
+// letrec fact = λn. if n == 0 then 1 else n * fact (n - 1)
+DbTermPtr factorial(int n) {
+    DbTermPtr body = db_if(db_op(Instruction::EQ, db_var(0), db_num(0)),
+                           db_num(1),
+                           db_op(Instruction::MUL, db_var(0),
+                                 db_app(db_var(1), db_op(Instruction::SUB, db_var(0), db_num(1)))));
+    return db_letrec(db_abs(body), db_app(db_var(0), db_num(n)));
+}
+
+// letrec fib = λn. if n < 2 then n else fib (n - 1) + fib (n - 2)
+DbTermPtr fibonacci(int n) {
+    DbTermPtr body = db_if(db_op(Instruction::LT, db_var(0), db_num(2)),
+                           db_var(0),
+                           db_op(Instruction::ADD,
+                                 db_app(db_var(1), db_op(Instruction::SUB, db_var(0), db_num(1))),
+                                 db_app(db_var(1), db_op(Instruction::SUB, db_var(0), db_num(2)))));
+    return db_letrec(db_abs(body), db_app(db_var(0), db_num(n)));
+}
+
+// letrec count = λn. if n == 0 then 0 else 1 + count (n - 1)
+DbTermPtr count_up(int n) {
+    DbTermPtr body = db_if(db_op(Instruction::EQ, db_var(0), db_num(0)),
+                           db_num(0),
+                           db_op(Instruction::ADD, db_num(1),
+                                 db_app(db_var(1), db_op(Instruction::SUB, db_var(0), db_num(1)))));
+    return db_letrec(db_abs(body), db_app(db_var(0), db_num(n)));
+}
+
+void test_arithmetic() {
+    std::cout << "=== Арифметика, ветвление, рекурсия ===" << std::endl;
+    
+    std::cout << "(7 - 2) * 3 = "
+              << run_compiled(db_op(Instruction::MUL, db_op(Instruction::SUB, db_num(7), db_num(2)),
+                                    db_num(3))) << std::endl;
+    std::cout << "if 1 < 2 then 10 else 20 = "
+              << run_compiled(db_if(db_op(Instruction::LT, db_num(1), db_num(2)),
+                                    db_num(10), db_num(20))) << std::endl;
+    std::cout << "fact 10 = " << run_compiled(factorial(10)) << std::endl;
+    std::cout << "fact 13 = " << run_compiled(factorial(13)) << " (13! по модулю 2^32)" << std::endl;
+    std::cout << "fib 20 = " << run_compiled(fibonacci(20)) << std::endl;
+    
+    // Церковская цифра, прочитанная через примитивное сложение: (3 2) (λx. x + 1) 0 = 8
+    DbTermPtr succ = db_abs(db_op(Instruction::ADD, db_var(0), db_num(1)));
+    std::cout << "2^3 = " << run_compiled(db_app(db_app(db_app(church(3), church(2)), succ), db_num(0)))
+              << std::endl;
+}
+
+// Те же программы с плоскими окружениями; count 300000 переживает сборки векторов
+void test_flat_env() {
+    std::cout << "=== Плоские окружения ===" << std::endl;
+    
+    DbTermPtr k = db_app(db_app(db_abs(db_abs(db_var(1))), db_num(5)), db_num(7));
+    DbTermPtr select = db_abs(db_abs(db_abs(db_var(2))));
+    DbTermPtr first = db_app(db_app(db_app(select, db_num(1)), db_num(2)), db_num(3));
+    DbTermPtr succ = db_abs(db_op(Instruction::ADD, db_var(0), db_num(1)));
+    DbTermPtr power = db_app(db_app(db_app(church(3), church(2)), succ), db_num(0));
+    
+    std::cout << "K 5 7 = " << run_compiled(k, EnvMode::FLAT) << std::endl;
+    std::cout << "(λλλ.2) 1 2 3 = " << run_compiled(first, EnvMode::FLAT) << std::endl;
+    std::cout << "2^3 = " << run_compiled(power, EnvMode::FLAT) << std::endl;
+    std::cout << "fact 10 = " << run_compiled(factorial(10), EnvMode::FLAT) << std::endl;
+    std::cout << "fib 20 = " << run_compiled(fibonacci(20), EnvMode::FLAT) << std::endl;
+    
+    size_t collections = cell_heap().stats().collections;
+    std::cout << "count 300000 = " << run_compiled(count_up(300000), EnvMode::FLAT)
+              << ", сборок: " << cell_heap().stats().collections - collections << std::endl;
+}
+
+// Выделенные ячейки на тестовых программах без хэш-консинга и с ним
+void test_hash_consing() {
+    std::cout << "=== Хэш-консинг пар ===" << std::endl;
+    
+    Term a = make_shared_pair(make_number(1), make_shared_pair(make_atom("x"), make_empty()));
+    Term b = make_shared_pair(make_number(1), make_shared_pair(make_atom("x"), make_empty()));
+    std::cout << "[1, [x, ()]] == [1, [x, ()]]: " << (a == b ? "одна ячейка" : "разные ячейки") << std::endl;
+    
+    DbTermPtr succ = db_abs(db_op(Instruction::ADD, db_var(0), db_num(1)));
+    struct Sample { const char* label; DbTermPtr term; };
+    for (const Sample& sample : {Sample{"fact 10", factorial(10)},
+                                 Sample{"fib 20", fibonacci(20)},
+                                 Sample{"(3 2) succ 0", db_app(db_app(db_app(church(3), church(2)), succ), db_num(0))},
+                                 Sample{"count 10000", count_up(10000)}}) {
+        std::cout << sample.label << ":";
+        auto code = std::make_shared<const Program>(compile(sample.term));
+        for (bool enabled : {false, true}) {
+            CellHeap::Stats before = cell_heap().stats();
+            CAMMachine machine(make_empty(), code);
+            machine.setHashCons(enabled);
+            machine.run();
+            const CellHeap::Stats& after = cell_heap().stats();
+            std::cout << (enabled ? ", с хэш-консингом " : " ") << after.allocations - before.allocations
+                      << " ячеек";
+            if (enabled) std::cout << " (" << after.shared_hits - before.shared_hits << " совпадений)";
+            std::cout << " = " << machine.getResult().toString();
         }
+        std::cout << std::endl;
     }
-};
+    
+    // Таблица переживает сборки: живая общая пара находится по новому адресу,
+    // 300000 мёртвых пар (t, i) из таблицы выбрасываются
+    // Термы вне машин не являются корнями: константа строится заново после прошлых прогонов
+    Program code;
+    code.emit(Program::ENTRY, Instruction::CONST,
+              make_shared_pair(make_number(1), make_shared_pair(make_atom("x"), make_empty())));
+    for (int i = 0; i < 300000; ++i) {
+        code.emit(Program::ENTRY, Instruction::PUSH, make_number(i));
+        code.emit(Program::ENTRY, Instruction::CONS);
+        code.emit(Program::ENTRY, Instruction::CAR);
+    }
+    size_t collections = cell_heap().stats().collections;
+    CAMMachine machine(make_empty(), std::move(code));
+    machine.setHashCons(true);
+    machine.run();
+    Term again = make_shared_pair(make_number(1), make_shared_pair(make_atom("x"), make_empty()));
+    std::cout << "сборок: " << cell_heap().stats().collections - collections
+              << ", " << machine.getResult().toString() << " после сборки — "
+              << (machine.getResult() == again ? "та же ячейка" : "другая ячейка") << std::endl;
+}
 
-using Code = std::vector<Instruction>;
+// letrec loop = λn.λacc. if n == 0 then acc else loop (n - 1) (acc + 1)
+DbTermPtr tail_count(int n) {
+    DbTermPtr body = db_if(db_op(Instruction::EQ, db_var(1), db_num(0)),
+                           db_var(0),
+                           db_app(db_app(db_var(2), db_op(Instruction::SUB, db_var(1), db_num(1))),
+                                  db_op(Instruction::ADD, db_var(0), db_num(1))));
+    return db_letrec(db_abs(db_abs(body)), db_app(db_app(db_var(0), db_num(n)), db_num(0)));
+}
 
-// === Состояние КАМ ===
-struct State {
-    TermPtr term;
-    Code code;
-    std::vector<TermPtr> stack;
+// Хвостовая рекурсия глубиной в миллионы идёт в постоянном дампе,
+// нехвостовая — в дампе, растущем линейно, без роста кода
+void test_deep_recursion() {
+    std::cout << "=== Глубокая рекурсия ===" << std::endl;
     
-    void print(int step) const {
-        std::cout << std::setw(2) << step << " | "
-                  << std::setw(20) << (term ? term->toString() : "()") << " | "
-                  << std::setw(30);
-        
-        std::string codeStr;
-        for (const auto& instr : code) {
-            codeStr += instr.toString() + " ";
-        }
-        if (codeStr.empty()) codeStr = "ε";
-        std::cout << codeStr << " | [";
-        
-        for (size_t i = 0; i < stack.size(); ++i) {
-            if (i > 0) std::cout << ", ";
-            std::cout << (stack[i] ? stack[i]->toString() : "()");
-        }
-        std::cout << "]" << std::endl;
+    struct Sample { const char* label; DbTermPtr term; };
+    for (const Sample& sample : {Sample{"хвостовой цикл 3000000", tail_count(3000000)},
+                                 Sample{"count 1000000", count_up(1000000)}}) {
+        CAMMachine machine(make_empty(), compile(sample.term));
+        auto start = std::chrono::steady_clock::now();
+        machine.run();
+        auto end = std::chrono::steady_clock::now();
+        std::cout << sample.label << " = " << machine.getResult().toString()
+                  << ": " << machine.steps() << " шагов, "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << " мс, "
+                  << "наибольшая глубина дампа " << machine.peakDumpDepth() << std::endl;
     }
-};
+}
 
-// === Реализация КАМ ===
-class CAMMachine {
-private:
-    State state;
-    int stepCount;
+// Ассемблер и дизассемблер обратны друг другу; размер плотного кода
+void test_assembler() {
+    std::cout << "=== Ассемблер ===" << std::endl;
+    
+    std::string text = "push [1, [x, ()]] cdr car dup const 2 branch { const 10 } { quote -3 }";
+    Program program = assemble(text);
+    std::cout << text << " →" << std::endl << "  " << disassemble(program)
+              << (disassemble(program) == text ? " (совпадает)" : " (расходится)") << std::endl;
     
-    TermPtr car(TermPtr term) {
-        if (term && term->type == Term::PAIR) {
-            return term->first;
+    // Атом с цифрой на конце — атом; слово из цифр и букв — ошибка, а не число
+    std::string atoms = "const x1 const [-7, y_2]";
+    std::cout << atoms << " → " << disassemble(assemble(atoms))
+              << (disassemble(assemble(atoms)) == atoms ? " (совпадает)" : " (расходится)") << std::endl;
+    for (const char* bad : {"const 12ab3", "const -x", "const 99999999999"}) {
+        try {
+            assemble(bad);
+            std::cout << bad << " → принято (ошибка)" << std::endl;
+        } catch (const std::runtime_error& e) {
+            std::cout << bad << " → " << e.what() << std::endl;
         }
-        return make_empty();
     }
     
-    TermPtr cdr(TermPtr term) {
-        if (term && term->type == Term::PAIR) {
-            return term->second;
-        }
-        return make_empty();
+    Program fib = compile(fibonacci(20));
+    std::string fib_text = disassemble(fib);
+    std::cout << "fib: " << fib_text << std::endl;
+    std::cout << "повторная сборка: " << (disassemble(assemble(fib_text)) == fib_text ? "совпадает" : "расходится")
+              << ", fib 20 = " << [&] {
+                     CAMMachine machine(make_empty(), assemble(fib_text));
+                     machine.run();
+                     return machine.getResult().toString();
+                 }() << std::endl;
+    
+    size_t instructions = 0;
+    for (const auto& block : fib.blocks) instructions += block.size();
+    std::cout << "sizeof(Instruction) = " << sizeof(Instruction) << ", fib: " << instructions << " команд в "
+              << fib.blocks.size() << " блоках, " << fib.constants.size() << " констант, "
+              << fib.bytes() << " байт" << std::endl;
+}
+
+// Шаги без выделения ячеек не обращаются к куче C++ вовсе; выделяющие ячейки —
+// только за новым блоком CellHeap раз в 65536 ячеек. Первые шаги прогревают стеки.
+void test_zero_allocations() {
+    std::cout << "=== Выделения памяти на шаг ===" << std::endl;
+    
+    struct Sample { const char* label; std::string body; };
+    for (const Sample& sample : {Sample{"access/dup/swap/add", "dup access[0] swap access[1] add "},
+                                 Sample{"car/cdr/const/eq", "dup car swap cdr eq const 1 "},
+                                 Sample{"cons/car", "push 7 cons car "},
+                                 Sample{"cur/app", "cur { access[0] } push 3 cons app "}}) {
+        std::string text;
+        for (int i = 0; i < 100000; ++i) text += sample.body;
+        
+        CAMMachine machine(make_pair(make_number(4), make_number(5)), assemble(text));
+        for (int i = 0; i < 1000; ++i) machine.step();
+        size_t before = heap_allocations;
+        machine.run();
+        size_t allocations = heap_allocations - before;
+        std::cout << sample.label << ": " << machine.steps() - 1000 << " шагов, "
+                  << allocations << " выделений operator new" << std::endl;
     }
+}
+
+// Двоичная трасса в кольце из 8 записей: сохраняются последние шаги прогона
+void test_binary_trace() {
+    std::cout << "=== Двоичная трасса ===" << std::endl;
     
-    void execute_instruction(const std::string& instr_str) {
-        if (instr_str == "car") {
-            state.code.insert(state.code.begin(), Instruction(Instruction::CAR));
-        } else if (instr_str == "cdr") {
-            state.code.insert(state.code.begin(), Instruction(Instruction::CDR));
-        } else if (instr_str == "access[0]") {
-            state.code.insert(state.code.begin(), Instruction(Instruction::ACCESS, 0));
-        } else if (instr_str == "access[1]") {
-            state.code.insert(state.code.begin(), Instruction(Instruction::ACCESS, 1));
-        } else if (instr_str.rfind("push ", 0) == 0) {
-            // Обработка push инструкций
-            std::string value_str = instr_str.substr(5);
-            try {
-                int value = std::stoi(value_str);
-                state.code.insert(state.code.begin(), Instruction(Instruction::PUSH, make_number(value)));
-            } catch (...) {
-                state.code.insert(state.code.begin(), Instruction(Instruction::PUSH, make_atom(value_str)));
-            }
-        }
+    DbTermPtr term = db_app(db_app(church(3), db_abs(db_var(0))), db_num(9));
+    BasicCAMMachine<BinaryTrace> machine(make_empty(), compile(term), BinaryTrace(8));
+    machine.run();
+    
+    auto path = (std::filesystem::temp_directory_path() / "cam2_trace.bin").string();
+    bool saved = machine.tracer().save(path);
+    
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+    bool loaded = read_trace(path, header, records);
+    std::filesystem::remove(path);
+    
+    std::cout << "Результат: " << machine.getResult().toString()
+              << ", шагов: " << machine.steps()
+              << ", записано: " << header.total_steps << ", в файле: " << header.record_count
+              << (saved && loaded ? "" : " (ошибка ввода-вывода)") << std::endl;
+    for (const auto& record : records) {
+        std::cout << "  шаг " << record.step << ": " << TRACE_OPCODES[record.opcode]
+                  << ", стек " << record.stack_depth << ", дамп " << record.dump_depth << std::endl;
     }
     
-public:
-    CAMMachine(TermPtr initial_term, Code initial_code = {}) {
-        state.term = initial_term;
-        state.code = initial_code;
-        state.stack = {};
-        stepCount = 0;
+    // Атом записывается своим номером в таблице имён
+    BasicCAMMachine<BinaryTrace> atoms(make_empty(), assemble("const x1 const x1"), BinaryTrace(2));
+    atoms.run();
+    std::cout << "const x1: значение в трассе " << atoms.tracer().records().back().term_value
+              << ", номер атома " << make_atom("x1").atom_id() << std::endl;
+    try {
+        BinaryTrace empty(0);
+        std::cout << "BinaryTrace(0) принят (ошибка)" << std::endl;
+    } catch (const std::invalid_argument& e) {
+        std::cout << "BinaryTrace(0): " << e.what() << std::endl;
     }
+}
+
+// Возведение в степень церковских цифр: 2^16 применений тождественной функции
+template <typename Trace>
+void run_church_bench(const char* label, const std::shared_ptr<const Program>& code, Trace trace = {}) {
+    BasicCAMMachine<Trace> machine(make_empty(), code, std::move(trace));
+    auto start = std::chrono::steady_clock::now();
+    machine.run();
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << label << ": " << machine.steps() << " шагов, " << ms << " мс, "
+              << machine.steps() / ms / 1e3 << " млн шагов/с, результат "
+              << machine.getResult().toString() << std::endl;
+}
+
+void bench_church() {
+    std::cout << "=== Церковские цифры: (16 2) I 0 ===" << std::endl;
     
-    bool step() {
-        if (state.code.empty()) return false;
-        
-        printState();
-        
-        Instruction current = state.code.front();
-        state.code.erase(state.code.begin());
-        
-        switch (current.type) {
-            case Instruction::PUSH:
-                state.stack.push_back(state.term);
-                state.term = current.term;
-                break;
-                
-            case Instruction::SWAP:
-                if (!state.stack.empty()) {
-                    TermPtr top = state.stack.back();
-                    state.stack.pop_back();
-                    state.stack.push_back(state.term);
-                    state.term = top;
-                }
-                break;
-                
-            case Instruction::CONS:
-                if (!state.stack.empty()) {
-                    TermPtr first = state.stack.back();
-                    state.stack.pop_back();
-                    state.term = make_pair(first, state.term);
-                }
-                break;
-                
-            case Instruction::CAR:
-                state.term = car(state.term);
-                break;
-                
-            case Instruction::CDR:
-                state.term = cdr(state.term);
-                break;
-                
-            case Instruction::QUOTE:
-                state.term = make_quote(current.term);
-                break;
-                
-            case Instruction::CUR:
-                state.term = make_closure(current.code, state.term);
-                break;
-                
-            case Instruction::APP:
-                if (state.term && state.term->type == Term::PAIR) {
-                    TermPtr func = car(state.term);
-                    TermPtr arg = cdr(state.term);
-                    
-                    if (func && func->type == Term::CLOSURE) {
-                        // Сохраняем текущее состояние
-                        state.stack.push_back(state.term);
-                        
-                        // Устанавливаем окружение замыкания
-                        state.term = func->closure_env;
-                        
-                        // Добавляем код замыкания в обратном порядке
-                        for (auto it = func->closure_code.rbegin(); it != func->closure_code.rend(); ++it) {
-                            execute_instruction(*it);
-                        }
-                        
-                        // Добавляем аргумент в стек
-                        state.stack.push_back(arg);
-                    }
-                }
-                break;
-                
-            case Instruction::ACCESS:
-                if (current.index >= 0 && current.index < state.stack.size()) {
-                    state.term = state.stack[state.stack.size() - 1 - current.index];
-                }
-                break;
-        }
-        
-        stepCount++;
-        return !state.code.empty();
+    DbTermPtr term = db_app(db_app(db_app(church(16), church(2)), db_abs(db_var(0))), db_num(0));
+    auto code = std::make_shared<const Program>(compile(term));
+    run_church_bench<NoTrace>("без трассы", code);
+    run_church_bench<BinaryTrace>("двоичная трасса", code);
+}
+
+void run_numeric_bench(const char* label, const DbTermPtr& term) {
+    CAMMachine machine(make_empty(), compile(term));
+    auto start = std::chrono::steady_clock::now();
+    machine.run();
+    auto end = std::chrono::steady_clock::now();
+    std::cout << label << ": " << machine.steps() << " шагов, "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " мс, результат "
+              << machine.getResult().toString() << std::endl;
+}
+
+// Одно и то же число 2^16 — счётом на непосредственных числах и церковскими цифрами
+void bench_numeric() {
+    std::cout << "=== Числа против церковских цифр ===" << std::endl;
+    
+    DbTermPtr succ = db_abs(db_op(Instruction::ADD, db_var(0), db_num(1)));
+    run_numeric_bench("count 65536", count_up(65536));
+    run_numeric_bench("(16 2) succ 0", db_app(db_app(db_app(church(16), church(2)), succ), db_num(0)));
+    run_numeric_bench("fib 25", fibonacci(25));
+}
+
+// letrec loop = λn. if n == 0 then 0 else F 1 … d + loop (n - 1), где F = λx_1 … λx_d. тело
+// Тело: внешняя переменная x_1, сумма всех x_i или x_1, прочитанная reads раз
+DbTermPtr nested_loop(int depth, int iterations, bool sum_all, int reads = 1) {
+    DbTermPtr body = db_var(depth - 1);
+    if (sum_all) {
+        for (int i = depth - 2; i >= 0; --i) body = db_op(Instruction::ADD, body, db_var(i));
     }
+    for (int i = 1; i < reads; ++i) body = db_op(Instruction::ADD, body, db_var(depth - 1));
+    DbTermPtr call = body;
+    for (int i = 0; i < depth; ++i) call = db_abs(call);
+    for (int i = 1; i <= depth; ++i) call = db_app(call, db_num(i));
     
-    void printState() const { state.print(stepCount); }
+    DbTermPtr loop = db_if(db_op(Instruction::EQ, db_var(0), db_num(0)),
+                           db_num(0),
+                           db_op(Instruction::ADD, call,
+                                 db_app(db_var(1), db_op(Instruction::SUB, db_var(0), db_num(1)))));
+    return db_letrec(db_abs(loop), db_app(db_var(0), db_num(iterations)));
+}
+
+// Глубоко вложенные лямбды: доступ к внешней переменной и ко всем переменным
+void bench_env_modes() {
+    std::cout << "=== Вложенные пары против плоских окружений ===" << std::endl;
     
-    void run() {
-        std::cout << "Step |        Term         |             Code              | Stack" << std::endl;
-        std::cout << "-----|---------------------|-------------------------------|------" << std::endl;
-        while (step()) {}
-        printState();
+    struct Workload { const char* label; bool sum_all; int reads; };
+    for (Workload workload : {Workload{"внешняя", false, 1}, Workload{"сумма всех", true, 1},
+                              Workload{"внешняя x64", false, 64}}) {
+        for (int depth : {4, 16, 64}) {
+            auto code = std::make_shared<const Program>(compile(nested_loop(depth, 10000, workload.sum_all,
+                                                                            workload.reads)));
+            std::cout << workload.label << ", глубина " << depth << ":";
+            for (EnvMode mode : {EnvMode::NESTED, EnvMode::FLAT}) {
+                CAMMachine machine(make_empty(), code);
+                machine.setEnvMode(mode);
+                size_t cells = cell_heap().stats().allocations;
+                auto start = std::chrono::steady_clock::now();
+                machine.run();
+                auto end = std::chrono::steady_clock::now();
+                std::cout << (mode == EnvMode::FLAT ? "  плоские " : " пары ")
+                          << std::chrono::duration<double, std::milli>(end - start).count() << " мс, "
+                          << cell_heap().stats().allocations - cells << " ячеек ("
+                          << machine.getResult().toString() << ")";
+            }
+            std::cout << std::endl;
+        }
     }
+}
+
+// Длинная программа из 10^5 команд: каждый шаг O(1), весь прогон линеен
+void bench_long_program() {
+    std::cout << "=== Программа из 10^5 команд ===" << std::endl;
     
-    TermPtr getResult() const { return state.term; }
-};
+    for (int n : {10000, 30000, 100000}) {
+        Program code;
+        for (int i = 0; i < n / 3; ++i) {
+            code.emit(Program::ENTRY, Instruction::PUSH, make_number(i));
+            code.emit(Program::ENTRY, Instruction::CONS);
+            code.emit(Program::ENTRY, Instruction::CAR);
+        }
+        
+        CAMMachine machine(make_empty(), std::move(code));
+        auto start = std::chrono::steady_clock::now();
+        machine.run();
+        auto end = std::chrono::steady_clock::now();
+        std::cout << n << " команд: " << machine.steps() << " шагов, "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << " мс" << std::endl;
+    }
+}
 
-// === Тесты ===
-void test_kam_basic() {
-    std::cout << "=== Базовый тест КАМ: 2 + 3 ===" << std::endl;
+// Многократное применение замыканий: все CUR ссылаются на один блок,
+// APP лишь переключает указатель на код
+void bench_apply() {
+    std::cout << "=== 25000 применений замыкания ===" << std::endl;
     
-    Code code = {
-        Instruction(Instruction::PUSH, make_number(2)),
-        Instruction(Instruction::PUSH, make_number(3)),
-    };
+    Program code;
+    uint32_t identity = code.addBlock();
+    code.emit(identity, Instruction::ACCESS, 0u);
+    for (int i = 0; i < 25000; ++i) {
+        code.emit(Program::ENTRY, Instruction::CUR, identity);
+        code.emit(Program::ENTRY, Instruction::PUSH, make_number(i));
+        code.emit(Program::ENTRY, Instruction::CONS);
+        code.emit(Program::ENTRY, Instruction::APP);
+    }
     
-    CAMMachine machine(make_empty(), code);
+    CAMMachine machine(make_empty(), std::move(code));
+    auto start = std::chrono::steady_clock::now();
     machine.run();
-    std::cout << "Результат: " << machine.getResult()->toString() << std::endl;
+    auto end = std::chrono::steady_clock::now();
+    std::cout << machine.steps() << " шагов, "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " мс, результат "
+              << machine.getResult().toString() << std::endl;
 }
 
-void test_kam_simple_closure() {
-    std::cout << "=== Простое замыкание: const 5 ===" << std::endl;
+// Размер термов и скорость на программе, строящей длинную цепочку пар
+void bench_terms() {
+    std::cout << "=== Компактные термы ===" << std::endl;
     
-    // Замыкание, которое всегда возвращает 5
-    std::vector<std::string> const_code = {"push 5"};
-    
-    Code code = {
-        Instruction(Instruction::CUR, const_code),
-        Instruction(Instruction::PUSH, make_number(999)), // Любой аргумент
-        Instruction(Instruction::CONS),
-        Instruction(Instruction::APP)
-    };
+    const int n = 1000000;
+    Program code;
+    for (int i = 0; i < n; ++i) {
+        code.emit(Program::ENTRY, Instruction::PUSH, make_number(i));
+        code.emit(Program::ENTRY, Instruction::CONS);
+    }
+    code.emit(Program::ENTRY, Instruction::ACCESS, static_cast<uint32_t>(n - 1));
     
-    CAMMachine machine(make_empty(), code);
+    size_t cells_before = cell_heap().stats().allocations;
+    CAMMachine machine(make_empty(), std::move(code));
+    auto start = std::chrono::steady_clock::now();
     machine.run();
-    std::cout << "Результат: " << machine.getResult()->toString() << std::endl;
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    size_t cells = cell_heap().stats().allocations - cells_before;
+    
+    std::cout << "sizeof(Term) = " << sizeof(Term) << ", sizeof(Cell) = " << sizeof(Cell)
+              << ", байт на пару: " << cells * sizeof(Cell) / n << std::endl;
+    std::cout << machine.steps() << " шагов, " << machine.steps() / seconds / 1e6
+              << " млн шагов/с, результат " << machine.getResult().toString() << std::endl;
+    
+    const CellHeap::Stats& stats = cell_heap().stats();
+    std::cout << "Куча: выделено " << stats.allocations << " ячеек, сборок " << stats.collections
+              << ", выживаемость " << 100.0 * stats.survivalRate() << "%" << std::endl;
 }
 
-void test_kam_identity() {
-    std::cout << "=== Тождественное замыкание ===" << std::endl;
+// Живая структура переживает сборки, мусор от промежуточных пар — нет
+void test_gc() {
+    std::cout << "=== Тест: копирующая сборка ===" << std::endl;
     
-    // Замыкание, которое возвращает свой аргумент
-    std::vector<std::string> identity_code = {"access[0]"};
+    // Программа, собранная до чужих сборок и ещё не запущенная: её константы — корни
+    Program waiting = assemble("const [1, [x, ()]]");
     
-    Code code = {
-        Instruction(Instruction::CUR, identity_code),
-        Instruction(Instruction::PUSH, make_number(42)),
-        Instruction(Instruction::CONS),
-        Instruction(Instruction::APP)
-    };
+    const int n = 300000;
+    Program code;
+    code.emit(Program::ENTRY, Instruction::PUSH, make_pair(make_number(7), make_number(8)));
+    for (int i = 0; i < n; ++i) {
+        // t → (t, i) → t: каждая итерация оставляет одну мёртвую пару
+        code.emit(Program::ENTRY, Instruction::PUSH, make_number(i));
+        code.emit(Program::ENTRY, Instruction::CONS);
+        code.emit(Program::ENTRY, Instruction::CAR);
+    }
+    code.emit(Program::ENTRY, Instruction::CDR);
     
-    CAMMachine machine(make_empty(), code);
+    CellHeap::Stats before = cell_heap().stats();
+    CAMMachine machine(make_empty(), std::move(code));
     machine.run();
-    std::cout << "Результат: " << machine.getResult()->toString() << std::endl;
+    const CellHeap::Stats& after = cell_heap().stats();
+    
+    size_t collected = after.collected_cells - before.collected_cells;
+    size_t survived = after.survived_cells - before.survived_cells;
+    std::cout << "Результат: " << machine.getResult().toString() << std::endl;
+    std::cout << "Выделено ячеек: " << after.allocations - before.allocations
+              << ", сборок: " << after.collections - before.collections
+              << ", выживаемость: " << (collected ? 100.0 * survived / collected : 0.0) << "%"
+              << ", ячеек в куче: " << cell_heap().cells() << std::endl;
+    
+    CAMMachine late(make_empty(), std::move(waiting));
+    late.run();
+    std::cout << "Программа, собранная до сборок: " << late.getResult().toString() << std::endl;
 }
 
 int main() {
@@ -323,5 +557,39 @@ int main() {
     test_kam_identity();
     std::cout << std::endl;
     
+    test_gc();
+    std::cout << std::endl;
+    
+    test_compile();
+    std::cout << std::endl;
+    
+    test_arithmetic();
+    std::cout << std::endl;
+    
+    test_flat_env();
+    std::cout << std::endl;
+    
+    test_hash_consing();
+    std::cout << std::endl;
+    
+    test_assembler();
+    std::cout << std::endl;
+    
+    test_zero_allocations();
+    std::cout << std::endl;
+    
+    test_deep_recursion();
+    std::cout << std::endl;
+    
+    test_binary_trace();
+    std::cout << std::endl;
+    
+    bench_long_program();
+    bench_apply();
+    bench_terms();
+    bench_church();
+    bench_numeric();
+    bench_env_modes();
+    
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1154 @@
+#ifndef CAM2_H
+#define CAM2_H
+
+// Машина cam2: термы-слова над кучей ячеек, ассемблер, компилятор де Брёйна и BasicCAMMachine.
+// Всё лежит в пространстве имён cam2: имена CAMMachine и Program совпадают с другими машинами
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <sstream>
+#include <iomanip>
+#include <variant>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <stdexcept>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <new>
+#include <filesystem>
+
+#include "cam_trace.hpp"
+
+namespace cam2 {
+
+// === Базовые структуры данных ===
+struct Instruction;
+using Code = std::vector<Instruction>;
+struct Program;
+struct Cell;
+
+// Терм — одно машинное слово с тегом в младших трёх битах.
+// Числа, атомы (номер в таблице имён) и пустой терм хранятся непосредственно,
+// пары, замыкания и цитаты — ссылкой на 16-байтную ячейку кучи.
+class Term {
+public:
+    enum Type { EMPTY, ATOM, PAIR, CLOSURE, NUMBER, QUOTE, CODE, VECTOR };
+    
+    Term() : bits(EMPTY) {}
+    
+    static Term number(int value) {
+        return Term((static_cast<uintptr_t>(static_cast<intptr_t>(value)) << TAG_BITS) | NUMBER);
+    }
+    static Term atom(uint32_t id) { return Term((static_cast<uintptr_t>(id) << TAG_BITS) | ATOM); }
+    static Term cell(Type type, const Cell* cell) { return Term(reinterpret_cast<uintptr_t>(cell) | type); }
+    static Term code(const Code* code) { return Term(reinterpret_cast<uintptr_t>(code) | CODE); }
+    
+    Type type() const { return static_cast<Type>(bits & TAG_MASK); }
+    bool operator==(Term other) const { return bits == other.bits; }
+    bool operator!=(Term other) const { return bits != other.bits; }
+    uintptr_t word() const { return bits; }
+    
+    int number_value() const { return static_cast<int>(static_cast<intptr_t>(bits) >> TAG_BITS); }
+    const std::string& atom_value() const;
+    uint32_t atom_id() const { return static_cast<uint32_t>(bits >> TAG_BITS); }
+    Cell* cell() const { return reinterpret_cast<Cell*>(bits & ~TAG_MASK); }
+    
+    // Пара: first/second; замыкание: окружение и код; цитата: терм;
+    // вектор: длина в первом слове, элементы в следующих словах подряд идущих ячеек
+    Term first() const;
+    Term second() const;
+    Term closure_env() const;
+    const Code* closure_code() const;
+    Term quoted_term() const;
+    int vector_size() const;
+    Term* vector_data() const;
+    
+    std::string toString() const;
+    size_t closureSize() const;
+    
+private:
+    static constexpr int TAG_BITS = 3;
+    static constexpr uintptr_t TAG_MASK = (1u << TAG_BITS) - 1;
+    
+    explicit Term(uintptr_t bits) : bits(bits) {}
+    uintptr_t bits;
+};
+
+// Ячейка кучи: пара слов. У замыкания второе слово — указатель на код,
+// у цитаты второе слово не используется.
+struct alignas(16) Cell {
+    Term first;
+    Term second;
+};
+
+static_assert(sizeof(Term) == sizeof(uintptr_t), "Term must be one machine word");
+static_assert(sizeof(Cell) == 16, "Cell must be 16 bytes");
+
+inline Term Term::first() const { return cell()->first; }
+inline Term Term::second() const { return cell()->second; }
+inline Term Term::closure_env() const { return cell()->first; }
+inline const Code* Term::closure_code() const {
+    return reinterpret_cast<const Code*>(cell()->second.bits & ~TAG_MASK);
+}
+inline Term Term::quoted_term() const { return cell()->first; }
+inline int Term::vector_size() const { return type() == VECTOR ? cell()->first.number_value() : 0; }
+inline Term* Term::vector_data() const { return &cell()->first + 1; }
+
+// Число ячеек, занятых вектором из n элементов вместе со словом длины
+constexpr size_t vector_cells(size_t n) { return (n + 2) / 2; }
+
+// Таблица имён атомов: атом хранит номер, одинаковые имена совпадают
+class AtomTable {
+    std::vector<std::string> names;
+    std::map<std::string, uint32_t> ids;
+public:
+    uint32_t intern(const std::string& name) {
+        auto [it, inserted] = ids.emplace(name, static_cast<uint32_t>(names.size()));
+        if (inserted) names.push_back(name);
+        return it->second;
+    }
+    const std::string& name(uint32_t id) const { return names[id]; }
+};
+
+inline AtomTable& atom_table() {
+    static AtomTable table;
+    return table;
+}
+
+inline const std::string& Term::atom_value() const {
+    return atom_table().name(atom_id());
+}
+
+// Источник корней для сборщика: машина обновляет все свои ссылки на ячейки
+class CellHeap;
+struct RootSet {
+    virtual void traceRoots(CellHeap& heap) = 0;
+    virtual ~RootSet() = default;
+};
+
+// Куча ячеек: выделение сдвигом указателя в блоках полупространства
+// и копирующая сборка (Чейни) в новое полупространство.
+// Сборка выполняется только в безопасных точках машины (между шагами),
+// поэтому термы в локальных переменных инструкций не устаревают.
+class CellHeap {
+public:
+    struct Stats {
+        size_t allocations = 0;
+        size_t collections = 0;
+        size_t collected_cells = 0;   // ячеек в полупространствах перед сборками
+        size_t survived_cells = 0;    // из них скопировано
+        size_t shared_hits = 0;       // пар, найденных в таблице хэш-консинга
+        
+        double survivalRate() const {
+            return collected_cells ? static_cast<double>(survived_cells) / collected_cells : 0.0;
+        }
+    };
+    
+    Cell* allocate(Term first, Term second) {
+        ++stats_.allocations;
+        ++since_collection;
+        return bump(current, first, second);
+    }
+    
+    // Хэш-консинг: равные по составу пары — одна ячейка, равенство — сравнение слов.
+    // Такие ячейки неизменяемы; таблица слабая и перестраивается после сборки.
+    Cell* allocateShared(Term first, Term second) {
+        auto [it, inserted] = shared.try_emplace(PairKey{first.word(), second.word()}, nullptr);
+        if (inserted) {
+            it->second = allocate(first, second);
+        } else {
+            ++stats_.shared_hits;
+        }
+        return it->second;
+    }
+    
+    // Подряд идущие ячейки под вектор; неиспользуемое слово заполняется пустым термом
+    Cell* allocateVector(size_t n) {
+        size_t count = vector_cells(n);
+        stats_.allocations += count;
+        since_collection += count;
+        Cell* cells = bumpRun(current, count);
+        cells[0].first = Term::number(static_cast<int>(n));
+        cells[count - 1].second = Term();
+        return cells;
+    }
+    
+    void addRoots(RootSet* roots) { root_sets.push_back(roots); }
+    void removeRoots(RootSet* roots) { std::erase(root_sets, roots); }
+    
+    // Порог растёт вместе с живыми данными, чтобы сборка оставалась амортизированно линейной
+    bool shouldCollect() const { return since_collection >= threshold; }
+    void collect();
+    
+    // Вызываются из RootSet::traceRoots во время сборки
+    void forward(Term& term);
+    
+    const Stats& stats() const { return stats_; }
+    size_t cells() const { return current.cells; }
+    
+private:
+    static constexpr size_t BLOCK_CELLS = 1 << 16;
+    static constexpr size_t MIN_THRESHOLD = 1 << 18;
+    
+    struct Space {
+        std::vector<std::unique_ptr<Cell[]>> blocks;
+        size_t used = BLOCK_CELLS;    // занято в последнем блоке
+        size_t cells = 0;
+    };
+    
+    Cell* bump(Space& space, Term first, Term second) {
+        if (space.used == BLOCK_CELLS) {
+            space.blocks.push_back(std::make_unique_for_overwrite<Cell[]>(BLOCK_CELLS));
+            space.used = 0;
+        }
+        Cell* cell = &space.blocks.back()[space.used++];
+        cell->first = first;
+        cell->second = second;
+        ++space.cells;
+        return cell;
+    }
+    
+    // Хвост блока, в который не помещается вектор, заполняется пустыми ячейками:
+    // сборщик просматривает блоки целиком
+    Cell* bumpRun(Space& space, size_t count) {
+        if (count > BLOCK_CELLS) throw std::runtime_error("Vector does not fit into a heap block");
+        if (space.used + count > BLOCK_CELLS) {
+            if (!space.blocks.empty()) {
+                std::fill(&space.blocks.back()[space.used], &space.blocks.back()[BLOCK_CELLS], Cell{});
+            }
+            space.blocks.push_back(std::make_unique_for_overwrite<Cell[]>(BLOCK_CELLS));
+            space.used = 0;
+        }
+        Cell* cells = &space.blocks.back()[space.used];
+        space.used += count;
+        space.cells += count;
+        return cells;
+    }
+    
+    struct PairKey {
+        uintptr_t first, second;
+        bool operator==(const PairKey&) const = default;
+    };
+    struct PairKeyHash {
+        size_t operator()(const PairKey& key) const {
+            return std::hash<uintptr_t>()(key.first * 0x9E3779B97F4A7C15ull ^ key.second);
+        }
+    };
+    
+    Space current;
+    Space* to_space = nullptr;
+    std::unordered_map<PairKey, Cell*, PairKeyHash> shared;
+    std::vector<RootSet*> root_sets;
+    size_t since_collection = 0;
+    size_t threshold = MIN_THRESHOLD;
+    Stats stats_;
+};
+
+inline CellHeap& cell_heap() {
+    static CellHeap heap;
+    return heap;
+}
+
+// Перемещённая ячейка помечается словом с тегом CODE в первом поле:
+// в живых данных такой тег встречается только во втором поле замыкания
+inline void CellHeap::forward(Term& term) {
+    Term::Type type = term.type();
+    if (type != Term::PAIR && type != Term::CLOSURE && type != Term::QUOTE && type != Term::VECTOR) return;
+    
+    Cell* old_cell = term.cell();
+    if (old_cell->first.type() == Term::CODE) {
+        term = Term::cell(type, old_cell->first.cell());
+        return;
+    }
+    Cell* new_cell;
+    if (type == Term::VECTOR) {
+        size_t count = vector_cells(old_cell->first.number_value());
+        new_cell = bumpRun(*to_space, count);
+        std::copy(old_cell, old_cell + count, new_cell);
+    } else {
+        new_cell = bump(*to_space, old_cell->first, old_cell->second);
+    }
+    old_cell->first = Term::cell(Term::CODE, new_cell);
+    term = Term::cell(type, new_cell);
+}
+
+inline void CellHeap::collect() {
+    Space next;
+    to_space = &next;
+    for (RootSet* roots : root_sets) roots->traceRoots(*this);
+    
+    // Скопированные ячейки просматриваются по порядку; ссылки из них копируются в конец
+    for (size_t block = 0; block < next.blocks.size(); ++block) {
+        for (size_t i = 0; ; ++i) {
+            size_t limit = block + 1 == next.blocks.size() ? next.used : BLOCK_CELLS;
+            if (i >= limit) break;
+            // Слово длины вектора — число, сборщик его не трогает
+            Cell& cell = next.blocks[block][i];
+            forward(cell.first);
+            forward(cell.second);
+        }
+    }
+    
+    // Выжившие общие пары — с новыми адресами и новыми словами детей, мёртвые выбрасываются
+    if (!shared.empty()) {
+        std::unordered_map<PairKey, Cell*, PairKeyHash> rebuilt;
+        for (const auto& [key, cell] : shared) {
+            if (cell->first.type() != Term::CODE) continue;
+            Cell* moved = cell->first.cell();
+            rebuilt.emplace(PairKey{moved->first.word(), moved->second.word()}, moved);
+        }
+        shared.swap(rebuilt);
+    }
+    
+    ++stats_.collections;
+    stats_.collected_cells += current.cells;
+    stats_.survived_cells += next.cells;
+    current = std::move(next);
+    to_space = nullptr;
+    since_collection = 0;
+    threshold = std::max(MIN_THRESHOLD, 2 * current.cells);
+}
+
+// Фабричные функции
+inline Term make_empty() { return Term(); }
+inline Term make_atom(const std::string& name) { return Term::atom(atom_table().intern(name)); }
+inline Term make_number(int value) { return Term::number(value); }
+inline Term make_pair(Term first, Term second) {
+    return Term::cell(Term::PAIR, cell_heap().allocate(first, second));
+}
+inline Term make_shared_pair(Term first, Term second) {
+    return Term::cell(Term::PAIR, cell_heap().allocateShared(first, second));
+}
+inline Term make_closure(const Code* code, Term env) {
+    return Term::cell(Term::CLOSURE, cell_heap().allocate(env, Term::code(code)));
+}
+inline Term make_quote(Term term) { return Term::cell(Term::QUOTE, cell_heap().allocate(term, Term())); }
+
+// Плоское окружение: копия env с добавленным в конец значением; () — пустой вектор
+inline Term make_extended_vector(Term env, Term value) {
+    int n = env.vector_size();
+    Cell* cells = cell_heap().allocateVector(n + 1);
+    Term* data = &cells->first + 1;
+    if (n > 0) std::copy(env.vector_data(), env.vector_data() + n, data);
+    data[n] = value;
+    return Term::cell(Term::VECTOR, cells);
+}
+
+inline std::string Term::toString() const {
+    switch (type()) {
+        case EMPTY: return "()";
+        case ATOM: return atom_value();
+        case NUMBER: return std::to_string(number_value());
+        case PAIR: return "[" + first().toString() + ", " + second().toString() + "]";
+        case CLOSURE: return "Λ(" + std::to_string(closureSize()) + ")";
+        case QUOTE: return "'" + quoted_term().toString();
+        case VECTOR: {
+            std::string result = "<";
+            for (int i = 0; i < vector_size(); ++i) {
+                if (i > 0) result += ", ";
+                result += vector_data()[i].toString();
+            }
+            return result + ">";
+        }
+        default: return "unknown";
+    }
+}
+
+// === Инструкции КАМ ===
+// Команда — восемь байт: код операции и операнд. Операнд ACCESS — индекс де Брауна,
+// PUSH/QUOTE/CONST — номер в пуле констант программы, CUR/FIX — номер блока кода,
+// BRANCH — номер блока «да», блок «нет» следует за ним.
+struct Instruction {
+    enum Type : uint8_t { 
+        PUSH, SWAP, CONS, 
+        CAR, CDR, 
+        QUOTE, 
+        CUR, APP,
+        ACCESS,
+        DUP,        // категориальный push: копия терма на стек
+        CONST,      // терм заменяется константой
+        ADD, SUB, MUL, EQ, LT,  // первый операнд снимается со стека, второй — терм
+        BRANCH,     // число в терме выбирает ветвь, окружение снимается со стека
+        FIX,        // рекурсивное замыкание в циклическом окружении
+        RETURN      // возврат к продолжению с вершины дампа
+    };
+    
+    Type type;
+    uint32_t operand = 0;
+    
+    bool hasConstant() const { return type == PUSH || type == QUOTE || type == CONST; }
+    bool hasBlock() const { return type == CUR || type == FIX || type == BRANCH; }
+};
+
+static_assert(sizeof(Instruction) == 8, "Instruction must stay 8 bytes");
+
+// Имена команд общие с просмотрщиком трасс
+inline const char* opcode_name(Instruction::Type type) { return TRACE_OPCODES[type]; }
+
+// Программа: таблица блоков кода (блок 0 — точка входа) и пул констант.
+// Замыкание ссылается на свой блок; после запуска программа не меняется.
+// Пул констант — корни сборщика на всё время жизни программы, а не только
+// пока её исполняет машина: собранная заранее программа переживает чужие сборки.
+struct Program : RootSet {
+    static constexpr uint32_t ENTRY = 0;
+    
+    std::vector<Code> blocks{1};
+    // Машины держат программу как const; сборщик всё равно обновляет пул при перемещении ячеек
+    mutable std::vector<Term> constants;
+    std::unordered_map<uintptr_t, uint32_t> immediates;   // числа и атомы пула без повторов
+    
+    Program() { cell_heap().addRoots(this); }
+    Program(const Program& other)
+        : RootSet(other), blocks(other.blocks), constants(other.constants), immediates(other.immediates) {
+        cell_heap().addRoots(this);
+    }
+    Program(Program&& other)
+        : RootSet(other), blocks(std::move(other.blocks)), constants(std::move(other.constants)),
+          immediates(std::move(other.immediates)) {
+        cell_heap().addRoots(this);
+    }
+    // Присваивание меняет содержимое, регистрация остаётся за объектом
+    Program& operator=(const Program&) = default;
+    Program& operator=(Program&&) = default;
+    ~Program() override { cell_heap().removeRoots(this); }
+    
+    void traceRoots(CellHeap& heap) override {
+        for (Term& constant : constants) heap.forward(constant);
+    }
+    
+    uint32_t addBlock() {
+        blocks.emplace_back();
+        return static_cast<uint32_t>(blocks.size() - 1);
+    }
+    
+    // Непосредственные термы не перемещаются сборщиком, поэтому одинаковые хранятся один раз
+    uint32_t addConstant(Term term) {
+        bool immediate = term.type() == Term::NUMBER || term.type() == Term::ATOM || term.type() == Term::EMPTY;
+        if (immediate) {
+            auto it = immediates.find(term.word());
+            if (it != immediates.end()) return it->second;
+        }
+        constants.push_back(term);
+        uint32_t index = static_cast<uint32_t>(constants.size() - 1);
+        if (immediate) immediates.emplace(term.word(), index);
+        return index;
+    }
+    
+    void emit(uint32_t block, Instruction::Type type, uint32_t operand = 0) {
+        blocks[block].push_back(Instruction{type, operand});
+    }
+    
+    void emit(uint32_t block, Instruction::Type type, Term constant) {
+        emit(block, type, addConstant(constant));
+    }
+    
+    const Code& entry() const { return blocks[ENTRY]; }
+    
+    // Краткая запись одной команды: тела блоков не раскрываются
+    std::string toString(const Instruction& instr) const {
+        std::string name = opcode_name(instr.type);
+        if (instr.type == Instruction::ACCESS) return name + "[" + std::to_string(instr.operand) + "]";
+        if (instr.hasConstant()) return name + " " + constants[instr.operand].toString();
+        return name;
+    }
+    
+    size_t bytes() const {
+        size_t total = constants.size() * sizeof(Term) + blocks.size() * sizeof(Code);
+        for (const auto& block : blocks) total += block.size() * sizeof(Instruction);
+        return total;
+    }
+};
+
+inline size_t Term::closureSize() const { return closure_code()->size(); }
+
+// === Ассемблер ===
+// Текстовая форма: команды через пробел, тела CUR и FIX в фигурных скобках,
+// у BRANCH две ветви подряд; константы — числа, атомы, () и пары [a, b].
+//   dup cur { access[0] } swap const 42 cons app
+class Assembler {
+    const std::string& text;
+    size_t pos = 0;
+    Program program;
+    
+    void skipSpaces() {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+    }
+    
+    bool accept(char c) {
+        skipSpaces();
+        if (pos < text.size() && text[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+    
+    void expect(char c) {
+        if (!accept(c)) throw std::runtime_error(std::string("Expected '") + c + "' at " + std::to_string(pos));
+    }
+    
+    std::string word() {
+        skipSpaces();
+        size_t start = pos;
+        while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_' ||
+                                     (pos == start && text[pos] == '-'))) {
+            ++pos;
+        }
+        return text.substr(start, pos - start);
+    }
+    
+    Term constant() {
+        if (accept('(')) {
+            expect(')');
+            return make_empty();
+        }
+        if (accept('[')) {
+            Term first = constant();
+            expect(',');
+            Term second = constant();
+            expect(']');
+            return make_pair(first, second);
+        }
+        // Число — необязательный минус и только цифры; атом начинается с буквы или '_'
+        std::string value = word();
+        if (value.empty()) throw std::runtime_error("Expected constant at " + std::to_string(pos));
+        size_t digits = value[0] == '-' ? 1 : 0;
+        bool is_number = digits < value.size() &&
+            std::all_of(value.begin() + digits, value.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); });
+        if (is_number) {
+            try {
+                return make_number(std::stoi(value));
+            } catch (const std::out_of_range&) {
+                throw std::runtime_error("Number out of range: " + value);
+            }
+        }
+        if (value[0] == '-' || std::isdigit(static_cast<unsigned char>(value[0]))) {
+            throw std::runtime_error("Malformed constant: " + value);
+        }
+        return make_atom(value);
+    }
+    
+    void body(uint32_t block) {
+        expect('{');
+        sequence(block);
+        expect('}');
+    }
+    
+    // Тела блоков разбираются сразу, поэтому рекурсия ограничена их вложенностью
+    void sequence(uint32_t block) {
+        while (true) {
+            skipSpaces();
+            if (pos == text.size() || text[pos] == '}') return;
+            std::string name = word();
+            
+            auto type = static_cast<Instruction::Type>(0);
+            bool known = false;
+            for (int t = Instruction::PUSH; t <= Instruction::RETURN; ++t) {
+                if (name == opcode_name(static_cast<Instruction::Type>(t))) {
+                    type = static_cast<Instruction::Type>(t);
+                    known = true;
+                }
+            }
+            if (!known) throw std::runtime_error("Unknown instruction: " + name);
+            
+            if (type == Instruction::ACCESS) {
+                expect('[');
+                program.emit(block, type, static_cast<uint32_t>(std::stoul(word())));
+                expect(']');
+            } else if (type == Instruction::PUSH || type == Instruction::QUOTE || type == Instruction::CONST) {
+                program.emit(block, type, constant());
+            } else if (type == Instruction::CUR || type == Instruction::FIX) {
+                uint32_t target = program.addBlock();
+                program.emit(block, type, target);
+                body(target);
+            } else if (type == Instruction::BRANCH) {
+                uint32_t then_block = program.addBlock();
+                uint32_t else_block = program.addBlock();
+                program.emit(block, type, then_block);
+                body(then_block);
+                body(else_block);
+            } else {
+                program.emit(block, type);
+            }
+        }
+    }
+    
+public:
+    explicit Assembler(const std::string& text) : text(text) {}
+    
+    Program assemble() {
+        sequence(Program::ENTRY);
+        skipSpaces();
+        if (pos != text.size()) throw std::runtime_error("Unexpected '" + text.substr(pos, 1) + "'");
+        return std::move(program);
+    }
+};
+
+inline Program assemble(const std::string& text) { return Assembler(text).assemble(); }
+
+// Обратное преобразование: тот же текст, что принимает ассемблер
+inline std::string disassemble(const Program& program, uint32_t block = Program::ENTRY) {
+    std::string out;
+    for (const auto& instr : program.blocks[block]) {
+        if (!out.empty()) out += " ";
+        out += program.toString(instr);
+        if (instr.type == Instruction::CUR || instr.type == Instruction::FIX) {
+            out += " { " + disassemble(program, instr.operand) + " }";
+        } else if (instr.type == Instruction::BRANCH) {
+            out += " { " + disassemble(program, instr.operand) + " } { " +
+                   disassemble(program, instr.operand + 1) + " }";
+        }
+    }
+    return out;
+}
+
+// === Компиляция лямбда-термов ===
+// Терм с индексами де Брауна, как после DeBruijnConverter из cam_new.cpp.
+// Окружение — вложенные пары ((…((), v_k)…), v_0), переменная n — ACCESS n.
+// OP — примитивная операция (value — Instruction::Type), IF — условие fun, ветви arg и alt,
+// LETREC — fun = λ.M связывается сам с собой, arg — тело; в M индекс 0 — аргумент, 1 — функция.
+struct DbTerm {
+    enum Kind { VAR, ABS, APP, NUM, ATOM, OP, IF, LETREC };
+    
+    Kind kind;
+    int value = 0;                          // индекс переменной, число, номер атома или операция
+    std::shared_ptr<const DbTerm> fun;      // тело абстракции или функция применения
+    std::shared_ptr<const DbTerm> arg;
+    std::shared_ptr<const DbTerm> alt;
+};
+
+using DbTermPtr = std::shared_ptr<const DbTerm>;
+
+inline DbTermPtr db_var(int index) { return std::make_shared<const DbTerm>(DbTerm{DbTerm::VAR, index, nullptr, nullptr, nullptr}); }
+inline DbTermPtr db_num(int value) { return std::make_shared<const DbTerm>(DbTerm{DbTerm::NUM, value, nullptr, nullptr, nullptr}); }
+inline DbTermPtr db_atom(const std::string& name) {
+    int id = static_cast<int>(atom_table().intern(name));
+    return std::make_shared<const DbTerm>(DbTerm{DbTerm::ATOM, id, nullptr, nullptr, nullptr});
+}
+inline DbTermPtr db_abs(DbTermPtr body) {
+    return std::make_shared<const DbTerm>(DbTerm{DbTerm::ABS, 0, std::move(body), nullptr, nullptr});
+}
+inline DbTermPtr db_app(DbTermPtr fun, DbTermPtr arg) {
+    return std::make_shared<const DbTerm>(DbTerm{DbTerm::APP, 0, std::move(fun), std::move(arg), nullptr});
+}
+inline DbTermPtr db_op(Instruction::Type op, DbTermPtr left, DbTermPtr right) {
+    return std::make_shared<const DbTerm>(DbTerm{DbTerm::OP, op, std::move(left), std::move(right), nullptr});
+}
+inline DbTermPtr db_if(DbTermPtr cond, DbTermPtr then_branch, DbTermPtr else_branch) {
+    return std::make_shared<const DbTerm>(
+        DbTerm{DbTerm::IF, 0, std::move(cond), std::move(then_branch), std::move(else_branch)});
+}
+inline DbTermPtr db_letrec(DbTermPtr function, DbTermPtr body) {
+    if (function->kind != DbTerm::ABS) throw std::runtime_error("letrec expects an abstraction");
+    return std::make_shared<const DbTerm>(DbTerm{DbTerm::LETREC, 0, std::move(function), std::move(body), nullptr});
+}
+
+// Схема компиляции:
+//   [n]   = access[n]              (цепочка car…car cdr одной командой)
+//   [λM]  = cur([M])
+//   [M N] = dup [M] swap [N] cons app
+//   [k]   = const k                (число или атом)
+//   [a op b]            = dup [a] swap [b] op
+//   [if c then t else e] = dup [c] branch([t], [e])
+//   [letrec f = λM in N] = fix([M]) [N]
+// Тела замыканий и ветви заканчиваются командой return; app и branch перед return —
+// хвостовые и не кладут продолжение в дамп.
+// Обход итеративный: глубина терма не ограничена стеком вызовов
+inline Program compile(const DbTermPtr& root) {
+    struct Task {
+        const DbTerm* term;     // nullptr — записать return в конец блока
+        int stage;
+        uint32_t block;         // блок программы, в который пишется код терма
+    };
+    
+    Program program;
+    std::vector<Task> tasks{{root.get(), 0, Program::ENTRY}};
+    
+    while (!tasks.empty()) {
+        Task task = tasks.back();
+        tasks.pop_back();
+        uint32_t out = task.block;
+        if (!task.term) {
+            program.emit(out, Instruction::RETURN);
+            continue;
+        }
+        const DbTerm& term = *task.term;
+        
+        switch (term.kind) {
+            case DbTerm::VAR:
+                program.emit(out, Instruction::ACCESS, static_cast<uint32_t>(term.value));
+                break;
+                
+            case DbTerm::NUM:
+                program.emit(out, Instruction::CONST, make_number(term.value));
+                break;
+                
+            case DbTerm::ATOM:
+                program.emit(out, Instruction::CONST, Term::atom(static_cast<uint32_t>(term.value)));
+                break;
+                
+            case DbTerm::ABS: {
+                uint32_t body = program.addBlock();
+                program.emit(out, Instruction::CUR, body);
+                tasks.push_back({nullptr, 0, body});
+                tasks.push_back({term.fun.get(), 0, body});
+                break;
+            }
+                
+            case DbTerm::OP:
+                if (task.stage == 0) {
+                    program.emit(out, Instruction::DUP);
+                    tasks.push_back({task.term, 1, out});
+                    tasks.push_back({term.fun.get(), 0, out});
+                } else if (task.stage == 1) {
+                    program.emit(out, Instruction::SWAP);
+                    tasks.push_back({task.term, 2, out});
+                    tasks.push_back({term.arg.get(), 0, out});
+                } else {
+                    program.emit(out, static_cast<Instruction::Type>(term.value));
+                }
+                break;
+                
+            case DbTerm::IF:
+                // Этапы: dup [c] | branch; блоки ветвей идут подряд
+                if (task.stage == 0) {
+                    program.emit(out, Instruction::DUP);
+                    tasks.push_back({task.term, 1, out});
+                    tasks.push_back({term.fun.get(), 0, out});
+                } else {
+                    uint32_t then_block = program.addBlock();
+                    uint32_t else_block = program.addBlock();
+                    program.emit(out, Instruction::BRANCH, then_block);
+                    tasks.push_back({nullptr, 0, else_block});
+                    tasks.push_back({term.alt.get(), 0, else_block});
+                    tasks.push_back({nullptr, 0, then_block});
+                    tasks.push_back({term.arg.get(), 0, then_block});
+                }
+                break;
+                
+            case DbTerm::LETREC: {
+                uint32_t body = program.addBlock();
+                program.emit(out, Instruction::FIX, body);
+                tasks.push_back({term.arg.get(), 0, out});
+                tasks.push_back({nullptr, 0, body});
+                tasks.push_back({term.fun->fun.get(), 0, body});
+                break;
+            }
+                
+            case DbTerm::APP:
+                // Этапы: dup [M] | swap [N] | cons app
+                if (task.stage == 0) {
+                    program.emit(out, Instruction::DUP);
+                    tasks.push_back({task.term, 1, out});
+                    tasks.push_back({term.fun.get(), 0, out});
+                } else if (task.stage == 1) {
+                    program.emit(out, Instruction::SWAP);
+                    tasks.push_back({task.term, 2, out});
+                    tasks.push_back({term.arg.get(), 0, out});
+                } else {
+                    program.emit(out, Instruction::CONS);
+                    program.emit(out, Instruction::APP);
+                }
+                break;
+        }
+    }
+    return program;
+}
+
+// === Состояние КАМ ===
+// Код неизменяем: исполнение идёт по счётчику команд pc,
+// вызов замыкания кладёт точку возврата в стек продолжений dump
+struct Frame {
+    const Code* code;
+    size_t pc;
+};
+
+struct State {
+    Term term;
+    const Program* program = nullptr;
+    const Code* code = nullptr;
+    size_t pc = 0;
+    std::vector<Term> stack;
+    std::vector<Frame> dump;
+    
+    void print(int step) const {
+        std::cout << std::setw(2) << step << " | "
+                  << std::setw(20) << term.toString() << " | "
+                  << std::setw(30);
+        
+        std::string codeStr;
+        for (size_t i = pc; i < code->size(); ++i) {
+            codeStr += program->toString((*code)[i]) + " ";
+        }
+        if (codeStr.empty()) codeStr = "ε";
+        std::cout << codeStr << " | [";
+        
+        for (size_t i = 0; i < stack.size(); ++i) {
+            if (i > 0) std::cout << ", ";
+            std::cout << stack[i].toString();
+        }
+        std::cout << "] | " << dump.size() << std::endl;
+    }
+};
+
+// === Трассировка ===
+// Политика трассировки — параметр шаблона машины: с NoTrace вызовы
+// пусты и исчезают при компиляции, цикл step() не платит за трассировку.
+struct NoTrace {
+    void begin(const State&) {}
+    void step(const State&, int) {}
+    void end(const State&, int) {}
+};
+
+// Текстовая трасса: полное состояние перед каждой командой, O(размер состояния) на шаг
+struct PrintTrace {
+    void begin(const State&) {
+        std::cout << "Step |        Term         |             Code              | Stack | Dump" << std::endl;
+        std::cout << "-----|---------------------|-------------------------------|-------|-----" << std::endl;
+    }
+    void step(const State& state, int step) { state.print(step); }
+    void end(const State& state, int step) { state.print(step); }
+};
+
+// Двоичная трасса: записи фиксированного размера в кольцевом буфере,
+// хранятся последние capacity шагов; save() пишет их в файл для cam_trace
+class BinaryTrace {
+    std::vector<TraceRecord> ring;
+    uint64_t total = 0;
+    
+public:
+    BinaryTrace() : BinaryTrace(1 << 16) {}
+    explicit BinaryTrace(size_t capacity) : ring(capacity) {
+        if (capacity == 0) throw std::invalid_argument("BinaryTrace capacity must be positive");
+    }
+    
+    void begin(const State&) {}
+    void end(const State&, int) {}
+    
+    void step(const State& state, int step) {
+        const Instruction& instr = (*state.code)[state.pc];
+        TraceRecord& record = ring[total % ring.size()];
+        record.step = static_cast<uint64_t>(step);
+        record.term_value = termValue(state.term);
+        record.pc = static_cast<uint32_t>(state.pc);
+        record.stack_depth = static_cast<uint32_t>(state.stack.size());
+        record.dump_depth = static_cast<uint32_t>(state.dump.size());
+        record.operand = instr.hasConstant() ? static_cast<int32_t>(termValue(state.program->constants[instr.operand]))
+                                             : static_cast<int32_t>(instr.operand);
+        record.opcode = static_cast<uint8_t>(instr.type);
+        record.term_type = static_cast<uint8_t>(state.term.type());
+        record.reserved = 0;
+        record.reserved2 = 0;
+        ++total;
+    }
+    
+    uint64_t steps() const { return total; }
+    
+    // Записи в порядке исполнения
+    std::vector<TraceRecord> records() const {
+        size_t count = std::min<uint64_t>(total, ring.size());
+        std::vector<TraceRecord> result;
+        result.reserve(count);
+        for (uint64_t i = total - count; i < total; ++i) result.push_back(ring[i % ring.size()]);
+        return result;
+    }
+    
+    bool save(const std::string& path) const {
+        TraceHeader header;
+        header.total_steps = total;
+        std::vector<TraceRecord> saved = records();
+        header.record_count = saved.size();
+        return write_trace(path, header, saved);
+    }
+    
+private:
+    static int64_t termValue(Term term) {
+        switch (term.type()) {
+            case Term::NUMBER: return term.number_value();
+            case Term::ATOM: return term.atom_id();
+            default: return 0;
+        }
+    }
+};
+
+static_assert(Instruction::RETURN + 1 == TRACE_OPCODE_COUNT, "cam_trace.hpp opcode table is out of date");
+static_assert(Term::VECTOR + 1 == TRACE_TERM_TYPE_COUNT, "cam_trace.hpp term table is out of date");
+
+// Представление окружения: вложенные пары ((…, v_1), v_0), где access[n] проходит n ссылок,
+// или плоский вектор <v_k, …, v_0>, где access[n] — одна загрузка, а APP копирует окружение
+enum class EnvMode { NESTED, FLAT };
+
+// === Реализация КАМ ===
+template <typename Trace = NoTrace>
+class BasicCAMMachine : public RootSet {
+private:
+    std::shared_ptr<const Program> program;   // блоки кода и константы; замыкания ссылаются на блоки
+    State state;
+    int stepCount;
+    size_t peakDump = 0;
+    Trace trace;
+    EnvMode env_mode = EnvMode::NESTED;
+    bool hash_cons = false;
+    
+    Term pair(Term first, Term second) {
+        return hash_cons ? make_shared_pair(first, second) : make_pair(first, second);
+    }
+    
+    Term extendEnv(Term env, Term value) {
+        return env_mode == EnvMode::FLAT ? make_extended_vector(env, value) : pair(env, value);
+    }
+    
+    Term car(Term term) {
+        if (term.type() == Term::PAIR) {
+            return term.first();
+        }
+        return make_empty();
+    }
+    
+    // Операции над непосредственными числами; сравнения дают 1 или 0
+    // Числа — 32-битные со знаком; add, sub и mul берутся по модулю 2^32
+    // (дополнительный код), переполнение не является ошибкой программы
+    static Term arithmetic(Instruction::Type op, Term left, Term right) {
+        if (left.type() != Term::NUMBER || right.type() != Term::NUMBER) return make_empty();
+        int a = left.number_value();
+        int b = right.number_value();
+        uint32_t ua = static_cast<uint32_t>(a);
+        uint32_t ub = static_cast<uint32_t>(b);
+        switch (op) {
+            case Instruction::ADD: return make_number(static_cast<int>(ua + ub));
+            case Instruction::SUB: return make_number(static_cast<int>(ua - ub));
+            case Instruction::MUL: return make_number(static_cast<int>(ua * ub));
+            case Instruction::EQ: return make_number(a == b);
+            case Instruction::LT: return make_number(a < b);
+            default: return make_empty();
+        }
+    }
+    
+    Term cdr(Term term) {
+        if (term.type() == Term::PAIR) {
+            return term.second();
+        }
+        return make_empty();
+    }
+    
+    // Вызов в хвостовой позиции: за командой идёт return или блок кончается,
+    // тогда продолжение вызывающего уже лежит в дампе и новое не нужно
+    bool inTailPosition() const {
+        return state.pc == state.code->size() || (*state.code)[state.pc].type == Instruction::RETURN;
+    }
+    
+    void pushContinuation() {
+        state.dump.push_back({state.code, state.pc});
+        if (state.dump.size() > peakDump) peakDump = state.dump.size();
+    }
+    
+    // Возврат из тела замыкания: код закончился, продолжаем с точки вызова
+    bool returnFromBody() {
+        while (state.pc == state.code->size()) {
+            if (state.dump.empty()) return false;
+            state.code = state.dump.back().code;
+            state.pc = state.dump.back().pc;
+            state.dump.pop_back();
+        }
+        return true;
+    }
+    
+public:
+    // Стеки значений и продолжений выделяются заранее и растут только на глубоких вызовах
+    static constexpr size_t INITIAL_STACK = 1024;
+    
+    BasicCAMMachine(Term initial_term, Program initial_program = {}, Trace trace = {})
+        : BasicCAMMachine(initial_term, std::make_shared<const Program>(std::move(initial_program)),
+                          std::move(trace)) {}
+    
+    // Общая программа: несколько машин исполняют одни блоки без копирования
+    BasicCAMMachine(Term initial_term, std::shared_ptr<const Program> shared_program, Trace trace = {})
+        : program(std::move(shared_program)), trace(std::move(trace)) {
+        state.term = initial_term;
+        state.program = program.get();
+        state.code = &program->entry();
+        state.stack.reserve(INITIAL_STACK);
+        state.dump.reserve(INITIAL_STACK);
+        stepCount = 0;
+        cell_heap().addRoots(this);
+    }
+    
+    ~BasicCAMMachine() override { cell_heap().removeRoots(this); }
+    BasicCAMMachine(const BasicCAMMachine&) = delete;
+    BasicCAMMachine& operator=(const BasicCAMMachine&) = delete;
+    
+    void traceRoots(CellHeap& heap) override {
+        heap.forward(state.term);
+        for (auto& term : state.stack) heap.forward(term);
+    }
+    
+    Trace& tracer() { return trace; }
+    
+    // Задаётся до запуска; код один и тот же для обоих представлений
+    void setEnvMode(EnvMode mode) { env_mode = mode; }
+    
+    // Пары CONS и окружения APP берутся из таблицы хэш-консинга
+    void setHashCons(bool enabled) { hash_cons = enabled; }
+    
+    bool step() {
+        if (!returnFromBody()) return false;
+        
+        // Безопасная точка: ни одна инструкция не держит термов в локальных переменных
+        if (cell_heap().shouldCollect()) cell_heap().collect();
+        
+        trace.step(state, stepCount);
+        
+        const Instruction& current = (*state.code)[state.pc++];
+        
+        switch (current.type) {
+            case Instruction::PUSH:
+                state.stack.push_back(state.term);
+                state.term = program->constants[current.operand];
+                break;
+                
+            case Instruction::SWAP:
+                if (!state.stack.empty()) {
+                    std::swap(state.stack.back(), state.term);
+                }
+                break;
+                
+            case Instruction::CONS:
+                if (!state.stack.empty()) {
+                    Term first = state.stack.back();
+                    state.stack.pop_back();
+                    state.term = pair(first, state.term);
+                }
+                break;
+                
+            case Instruction::CAR:
+                state.term = car(state.term);
+                break;
+                
+            case Instruction::CDR:
+                state.term = cdr(state.term);
+                break;
+                
+            case Instruction::QUOTE:
+                state.term = make_quote(program->constants[current.operand]);
+                break;
+                
+            case Instruction::DUP:
+                state.stack.push_back(state.term);
+                break;
+                
+            case Instruction::CONST:
+                state.term = program->constants[current.operand];
+                break;
+                
+            case Instruction::ADD:
+            case Instruction::SUB:
+            case Instruction::MUL:
+            case Instruction::EQ:
+            case Instruction::LT:
+                if (!state.stack.empty()) {
+                    Term left = state.stack.back();
+                    state.stack.pop_back();
+                    state.term = arithmetic(current.type, left, state.term);
+                }
+                break;
+                
+            case Instruction::BRANCH:
+                // Ветвь исполняется в окружении со стека, затем возврат к следующей команде
+                if (!state.stack.empty()) {
+                    bool taken = state.term.type() == Term::NUMBER && state.term.number_value() != 0;
+                    state.term = state.stack.back();
+                    state.stack.pop_back();
+                    if (!inTailPosition()) pushContinuation();
+                    state.code = &program->blocks[current.operand + (taken ? 0 : 1)];
+                    state.pc = 0;
+                }
+                break;
+                
+            case Instruction::FIX: {
+                // e => e' = (e, Λ(M, e')): замыкание видит себя по индексу 1 своего тела
+                // Ячейка дописывается после выделения, поэтому не берётся из таблицы хэш-консинга
+                Term env = env_mode == EnvMode::FLAT ? make_extended_vector(state.term, make_empty())
+                                                     : make_pair(state.term, make_empty());
+                Term closure = make_closure(&program->blocks[current.operand], env);
+                if (env_mode == EnvMode::FLAT) {
+                    env.vector_data()[env.vector_size() - 1] = closure;
+                } else {
+                    env.cell()->second = closure;
+                }
+                state.term = env;
+                break;
+            }
+                
+            case Instruction::CUR:
+                state.term = make_closure(&program->blocks[current.operand], state.term);
+                break;
+                
+            case Instruction::APP:
+                // [Λ(c, e), v] => [e, v], исполняется c, затем возврат к вызывающему коду
+                if (state.term.type() == Term::PAIR) {
+                    Term func = car(state.term);
+                    Term arg = cdr(state.term);
+                    
+                    if (func.type() == Term::CLOSURE) {
+                        if (!inTailPosition()) pushContinuation();
+                        state.code = func.closure_code();
+                        state.pc = 0;
+                        state.term = extendEnv(func.closure_env(), arg);
+                    }
+                }
+                break;
+                
+            case Instruction::RETURN:
+                // Пустой дамп — возврат с верхнего уровня, машина останавливается
+                if (state.dump.empty()) {
+                    state.pc = state.code->size();
+                } else {
+                    state.code = state.dump.back().code;
+                    state.pc = state.dump.back().pc;
+                    state.dump.pop_back();
+                }
+                break;
+                
+            case Instruction::ACCESS: {
+                if (env_mode == EnvMode::FLAT) {
+                    int size = state.term.vector_size();
+                    state.term = static_cast<int>(current.operand) < size
+                        ? state.term.vector_data()[size - 1 - current.operand] : make_empty();
+                    break;
+                }
+                // Переменная с индексом де Брауна n: n раз car, затем cdr
+                Term env = state.term;
+                for (uint32_t i = 0; i < current.operand; ++i) env = car(env);
+                state.term = cdr(env);
+                break;
+            }
+        }
+        
+        stepCount++;
+        return returnFromBody();
+    }
+    
+    void printState() const { state.print(stepCount); }
+    
+    void run() {
+        trace.begin(state);
+        while (step()) {}
+        trace.end(state, stepCount);
+    }
+    
+    int steps() const { return stepCount; }
+    size_t peakDumpDepth() const { return peakDump; }
+    Term getResult() const { return state.term; }
+};
+
+using CAMMachine = BasicCAMMachine<>;
+
+} // namespace cam2
+
+#endif
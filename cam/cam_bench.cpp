@@ -0,0 +1,349 @@
+// Сравнение трёх вычислителей на общих нагрузках:
+//   normalize из cam.cpp (редукция подстановкой), CAMMachine из cam_new.hpp
+//   и CAMMachine из cam2.hpp.
+//   g++ -std=c++20 -O2 cam_bench.cpp cam.cpp -o cam_bench
+//   ./cam_bench [нагрузка [размер [зерно]]]
+// Нагрузки: church (c_n c_2) I a, tower (S K K)^n a, random — случайный
+// просто типизированный терм типа o. Каждая строка вывода — JSON-объект.
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <variant>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <new>
+
+#include "cam.hpp"
+#include "cam_new.hpp"
+#include "cam2.hpp"
+
+// === Учёт памяти ===
+// Перед каждым блоком хранится его размер, чтобы считать живые байты и их пик
+size_t heap_allocations = 0;
+size_t live_bytes = 0;
+size_t peak_live_bytes = 0;
+
+constexpr size_t HEADER = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    char* block = static_cast<char*>(std::malloc(size + HEADER));
+    if (!block) throw std::bad_alloc();
+    *reinterpret_cast<size_t*>(block) = size;
+    ++heap_allocations;
+    live_bytes += size;
+    peak_live_bytes = std::max(peak_live_bytes, live_bytes);
+    return block + HEADER;
+}
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    if (!ptr) return;
+    char* block = static_cast<char*>(ptr) - HEADER;
+    live_bytes -= *reinterpret_cast<size_t*>(block);
+    std::free(block);
+}
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+
+// === Общее представление нагрузок ===
+// Бестиповый терм с индексами де Брёйна и одной свободной константой a
+struct Lam;
+using LamPtr = std::shared_ptr<const Lam>;
+
+struct Lam {
+    enum Kind { VAR, ABS, APP, FREE };
+    Kind kind;
+    int index;
+    LamPtr left, right;
+};
+
+LamPtr lam_var(int index) { return std::make_shared<const Lam>(Lam{Lam::VAR, index, nullptr, nullptr}); }
+LamPtr lam_abs(LamPtr body) { return std::make_shared<const Lam>(Lam{Lam::ABS, 0, std::move(body), nullptr}); }
+LamPtr lam_app(LamPtr fun, LamPtr arg) {
+    return std::make_shared<const Lam>(Lam{Lam::APP, 0, std::move(fun), std::move(arg)});
+}
+LamPtr lam_free() { return std::make_shared<const Lam>(Lam{Lam::FREE, 0, nullptr, nullptr}); }
+
+size_t lam_size(const LamPtr& term) {
+    switch (term->kind) {
+        case Lam::ABS: return 1 + lam_size(term->left);
+        case Lam::APP: return 1 + lam_size(term->left) + lam_size(term->right);
+        default: return 1;
+    }
+}
+
+// Переменная на глубине depth называется v<depth>, поэтому имена в cam.cpp
+// и в исходном тексте cam_new однозначно восстанавливаются из индексов
+std::string binder_name(int depth) { return "v" + std::to_string(depth); }
+
+Expr to_expr(const LamPtr& term, int depth = 0) {
+    static const Type o = make_typeconst("o");
+    switch (term->kind) {
+        case Lam::VAR: return make_variable(binder_name(depth - 1 - term->index), o);
+        case Lam::ABS: return make_lambda(binder_name(depth), o, to_expr(term->left, depth + 1));
+        case Lam::APP: return make_apply(to_expr(term->left, depth), to_expr(term->right, depth));
+        case Lam::FREE: return make_constant("a", o);
+    }
+    throw std::logic_error("Unknown term kind");
+}
+
+std::string to_source(const LamPtr& term, int depth = 0) {
+    switch (term->kind) {
+        case Lam::VAR: return binder_name(depth - 1 - term->index);
+        case Lam::ABS: return "(\\" + binder_name(depth) + "." + to_source(term->left, depth + 1) + ")";
+        case Lam::APP: return "(" + to_source(term->left, depth) + " " + to_source(term->right, depth) + ")";
+        case Lam::FREE: return "a";
+    }
+    throw std::logic_error("Unknown term kind");
+}
+
+cam2::DbTermPtr to_db(const LamPtr& term) {
+    switch (term->kind) {
+        case Lam::VAR: return cam2::db_var(term->index);
+        case Lam::ABS: return cam2::db_abs(to_db(term->left));
+        case Lam::APP: return cam2::db_app(to_db(term->left), to_db(term->right));
+        case Lam::FREE: return cam2::db_atom("a");
+    }
+    throw std::logic_error("Unknown term kind");
+}
+
+// === Нагрузки ===
+LamPtr church_numeral(int n) {
+    LamPtr body = lam_var(0);
+    for (int i = 0; i < n; ++i) body = lam_app(lam_var(1), body);
+    return lam_abs(lam_abs(body));
+}
+
+LamPtr identity() { return lam_abs(lam_var(0)); }
+
+// (c_n c_2) I a: c_n c_2 = c_{2^n}, то есть 2^n применений I
+LamPtr church_workload(int n) {
+    return lam_app(lam_app(lam_app(church_numeral(n), church_numeral(2)), identity()), lam_free());
+}
+
+// S K K x = x; башня из n вложенных применений S K K к константе
+LamPtr tower_workload(int n) {
+    LamPtr s = lam_abs(lam_abs(lam_abs(lam_app(lam_app(lam_var(2), lam_var(0)), lam_app(lam_var(1), lam_var(0))))));
+    LamPtr k = lam_abs(lam_abs(lam_var(1)));
+    LamPtr term = lam_free();
+    for (int i = 0; i < n; ++i) term = lam_app(lam_app(lam_app(s, k), k), term);
+    return term;
+}
+
+// Простые типы над базовым o; nullptr — сам o
+struct SimpleType;
+using SimpleTypePtr = std::shared_ptr<const SimpleType>;
+struct SimpleType {
+    SimpleTypePtr from, to;
+};
+
+SimpleTypePtr arrow(SimpleTypePtr from, SimpleTypePtr to) {
+    return std::make_shared<const SimpleType>(SimpleType{std::move(from), std::move(to)});
+}
+
+bool same_type(const SimpleTypePtr& a, const SimpleTypePtr& b) {
+    if (!a || !b) return !a && !b;
+    return same_type(a->from, b->from) && same_type(a->to, b->to);
+}
+
+// Случайный терм заданного типа: бюджет ограничивает число применений,
+// после его исчерпания терм достраивается лямбдами, переменными и константой a
+class RandomTerms {
+    std::mt19937 rng;
+    std::vector<SimpleTypePtr> context;   // типы переменных, последняя — индекс 0
+    int budget = 0;
+
+    bool chance(double p) { return std::uniform_real_distribution<>(0.0, 1.0)(rng) < p; }
+
+    std::vector<int> variables_of(const SimpleTypePtr& type) const {
+        std::vector<int> indices;
+        for (size_t i = 0; i < context.size(); ++i) {
+            if (same_type(context[context.size() - 1 - i], type)) indices.push_back(static_cast<int>(i));
+        }
+        return indices;
+    }
+
+    LamPtr generate(const SimpleTypePtr& type) {
+        --budget;
+        if (type && (budget <= 0 || chance(0.3))) {
+            context.push_back(type->from);
+            LamPtr body = generate(type->to);
+            context.pop_back();
+            return lam_abs(std::move(body));
+        }
+
+        std::vector<int> variables = variables_of(type);
+        if (!variables.empty() && (budget <= 0 || chance(0.3))) {
+            return lam_var(variables[std::uniform_int_distribution<size_t>(0, variables.size() - 1)(rng)]);
+        }
+        if (budget > 0) {
+            static const SimpleTypePtr o = nullptr;
+            static const SimpleTypePtr o_to_o = arrow(nullptr, nullptr);
+            const SimpleTypePtr& arg_type = chance(0.5) ? o : o_to_o;
+            LamPtr fun = generate(arrow(arg_type, type));
+            LamPtr arg = generate(arg_type);
+            return lam_app(std::move(fun), std::move(arg));
+        }
+        if (!type) return lam_free();
+        return generate(type);
+    }
+
+public:
+    explicit RandomTerms(unsigned seed) : rng(seed) {}
+
+    LamPtr closedOfBaseType(int size) {
+        budget = size;
+        context.clear();
+        return generate(nullptr);
+    }
+};
+
+LamPtr random_workload(int size, unsigned seed) {
+    return RandomTerms(seed).closedOfBaseType(size);
+}
+
+// === Прогоны ===
+struct Measurement {
+    double time_ms = 0;
+    long long steps = -1;          // у normalize — число бета-редукций
+    long long cells = -1;          // ячейки кучи cam2
+    size_t allocations = 0;
+    size_t peak_bytes = 0;
+    std::string result;
+};
+
+template <typename Run>
+Measurement measure(Run&& run) {
+    Measurement m;
+    size_t allocations_before = heap_allocations;
+    size_t live_before = live_bytes;
+    peak_live_bytes = live_bytes;
+    auto start = std::chrono::high_resolution_clock::now();
+    run(m);
+    auto end = std::chrono::high_resolution_clock::now();
+    m.time_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    m.allocations = heap_allocations - allocations_before;
+    m.peak_bytes = peak_live_bytes - live_before;
+    return m;
+}
+
+std::string expr_to_string(const Expr& expr) {
+    if (auto c = std::get_if<std::shared_ptr<Constant>>(&expr)) return (*c)->name;
+    if (auto v = std::get_if<std::shared_ptr<Variable>>(&expr)) return (*v)->name;
+    if (auto l = std::get_if<std::shared_ptr<Lambda>>(&expr)) return "\\" + (*l)->param + "." + expr_to_string((*l)->body);
+    auto a = std::get<std::shared_ptr<Apply>>(expr);
+    return "(" + expr_to_string(a->func) + " " + expr_to_string(a->arg) + ")";
+}
+
+// Тот же цикл, что в normalize, но с подсчётом шагов
+Measurement run_normalize(const LamPtr& term) {
+    Expr expr = to_expr(term);
+    return measure([&](Measurement& m) {
+        Expr current = expr;
+        bool reduced;
+        m.steps = -1;
+        do {
+            std::tie(current, reduced) = reduce(current);
+            ++m.steps;
+        } while (reduced);
+        m.result = expr_to_string(current);
+    });
+}
+
+Measurement run_cam_new(const LamPtr& term) {
+    std::string source = to_source(term);
+    return measure([&](Measurement& m) {
+        cam_new::CAMMachine machine;
+        machine.load(source);
+        machine.run();
+        m.steps = static_cast<long long>(machine.step_count());
+        m.result = machine.get_result();
+    });
+}
+
+// Блоки кучи ячеек cam2 общие для всех прогонов: первый прогон оплачивает
+// их выделение в peak_bytes, следующие переиспользуют; cells — ячейки за прогон
+Measurement run_cam2(const LamPtr& term) {
+    cam2::DbTermPtr db = to_db(term);
+    return measure([&](Measurement& m) {
+        size_t cells_before = cam2::cell_heap().stats().allocations;
+        cam2::CAMMachine machine(cam2::make_empty(), cam2::compile(db));
+        machine.run();
+        m.steps = machine.steps();
+        m.cells = static_cast<long long>(cam2::cell_heap().stats().allocations - cells_before);
+        m.result = machine.getResult().toString();
+    });
+}
+
+std::string json_string(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+void report(const std::string& workload, int size, size_t term_size, const std::string& engine, const Measurement& m) {
+    std::string result = m.result.size() > 60 ? m.result.substr(0, 57) + "..." : m.result;
+    std::cout << "{\"workload\": " << json_string(workload)
+              << ", \"size\": " << size
+              << ", \"term_size\": " << term_size
+              << ", \"engine\": " << json_string(engine)
+              << ", \"time_ms\": " << std::fixed << std::setprecision(3) << m.time_ms
+              << ", \"steps\": " << m.steps
+              << ", \"cells\": " << m.cells
+              << ", \"allocations\": " << m.allocations
+              << ", \"peak_bytes\": " << m.peak_bytes
+              << ", \"result\": " << json_string(result) << "}" << std::endl;
+}
+
+LamPtr make_workload(const std::string& workload, int size, unsigned seed) {
+    if (workload == "church") return church_workload(size);
+    if (workload == "tower") return tower_workload(size);
+    if (workload == "random") return random_workload(size, seed);
+    throw std::runtime_error("Unknown workload: " + workload);
+}
+
+// normalize копирует терм при каждой подстановке, поэтому на больших размерах
+// он пропускается: его время растёт быстрее, чем у машин.
+// Замеры печатаются, только если все вычислители получили один результат
+void bench(const std::string& workload, int size, unsigned seed, bool with_normalize) {
+    LamPtr term = make_workload(workload, size, seed);
+    size_t term_size = lam_size(term);
+    std::vector<std::pair<std::string, Measurement>> runs;
+    if (with_normalize) runs.emplace_back("normalize", run_normalize(term));
+    runs.emplace_back("cam_new", run_cam_new(term));
+    runs.emplace_back("cam2", run_cam2(term));
+    for (const auto& [engine, m] : runs) {
+        if (m.result != runs.front().second.result) {
+            throw std::runtime_error(workload + " " + std::to_string(size) + ": " + engine + " gives " + m.result +
+                                     ", " + runs.front().first + " gives " + runs.front().second.result);
+        }
+    }
+    for (const auto& [engine, m] : runs) report(workload, size, term_size, engine, m);
+}
+
+int main(int argc, char** argv) {
+    try {
+        if (argc > 1) {
+            int size = argc > 2 ? std::stoi(argv[2]) : 10;
+            unsigned seed = argc > 3 ? static_cast<unsigned>(std::stoul(argv[3])) : 1;
+            bench(argv[1], size, seed, true);
+            return 0;
+        }
+
+        for (int n : {4, 8, 12}) bench("church", n, 0, true);
+        bench("church", 16, 0, false);
+        for (int n : {10, 100, 1000}) bench("tower", n, 0, true);
+        bench("tower", 10000, 0, false);
+        for (unsigned seed = 1; seed <= 3; ++seed) bench("random", 50, seed, true);
+        for (unsigned seed = 1; seed <= 3; ++seed) bench("random", 2000, seed, false);
+    } catch (const std::exception& e) {
+        std::cerr << "Ошибка: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,547 +1,371 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <stack>
-#include <map>
 #include <memory>
-#include <variant>
 #include <stdexcept>
-#include <set>
-#include <algorithm>
-
-// AST типы
-struct Var;
-struct Abs;
-struct App;
-using Expr = std::variant<Var, Abs, App>;
-
-struct Var {
-    std::string name;
-    int de_bruijn_idx;
-};
-
-struct Abs {
-    std::string param;
-    std::shared_ptr<Expr> body;
-};
-
-struct App {
-    std::shared_ptr<Expr> fun;
-    std::shared_ptr<Expr> arg;
-};
-
-struct Thunk {
-    std::vector<int> saved_env;
-    size_t body_pos;
-    bool evaluated = false;
-    int value;
-};
-std::vector<Thunk> thunks;  // Хранилище thunk'ов
-
-template<class... Ts>
-struct overloaded : Ts... { using Ts::operator()...; };
-template<class... Ts>
-overloaded(Ts...) -> overloaded<Ts...>;
-
-class Parser {
-    std::string input;
-    size_t pos = 0;
-    std::set<std::string> bound_vars;
-    std::set<std::string> free_vars;
-    
-    void skip_whitespace() {
-        while (pos < input.size() && isspace(input[pos])) pos++;
-    }
-    
-    char peek() {
-        skip_whitespace();
-        return pos < input.size() ? input[pos] : '\0';
-    }
-    
-    char consume() {
-        skip_whitespace();
-        return pos < input.size() ? input[pos++] : '\0';
-    }
-    
-    std::string parse_identifier() {
-        skip_whitespace();
-        std::string id;
-        while (pos < input.size() && (isalpha(input[pos]) || isdigit(input[pos]) || input[pos] == '_')) {
-            id += input[pos++];
-        }
-        return id;
-    }
-    
-    std::shared_ptr<Expr> parse_atom() {
-        if (peek() == '\\') {
-            consume();
-            std::string param = parse_identifier();
-            if (peek() != '.') throw std::runtime_error("Expected '.'");
-            consume();
-            
-            bound_vars.insert(param);
-            auto body = parse_expr();
-            bound_vars.erase(param);
-            
-            return std::make_shared<Expr>(Abs{param, body});
-        } 
-        else if (peek() == '(') {
-            consume();
-            auto expr = parse_expr();
-            if (peek() != ')') throw std::runtime_error("Expected ')'");
-            consume();
-            return expr;
-        } 
-        else {
-            std::string name = parse_identifier();
-            if (name.empty()) throw std::runtime_error("Expected identifier");
-            
-            // Если переменная не связана, добавляем в свободные
-            if (bound_vars.find(name) == bound_vars.end()) {
-                free_vars.insert(name);
-            }
-            
-            return std::make_shared<Expr>(Var{name, -1});
-        }
-    }
-    
-    std::shared_ptr<Expr> parse_app() {
-        auto left = parse_atom();
-        while (peek() != '\0' && peek() != ')' && peek() != '\\') {
-            auto right = parse_atom();
-            left = std::make_shared<Expr>(App{left, right});
-        }
-        return left;
-    }
-    
-public:
-    Parser(const std::string& input) : input(input) {}
-    
-    std::shared_ptr<Expr> parse_expr() {
-        return parse_app();
-    }
-    
-    const std::set<std::string>& get_free_vars() const { return free_vars; }
-};
-
-// Преобразователь в де Брауновский индекс
-class DeBruijnConverter {
-    std::map<std::string, int> env;
-    int depth = 0;
-    std::set<std::string> free_vars;
-    
-public:
-    std::shared_ptr<Expr> convert(const std::shared_ptr<Expr>& expr) {
-        return std::visit(*this, *expr);
-    }
-    
-    std::shared_ptr<Expr> operator()(const Var& v) {
-        auto it = env.find(v.name);
-        if (it == env.end()) {
-            free_vars.insert(v.name);
-            return std::make_shared<Expr>(Var{v.name, -1});
-        }
-        int idx = depth - it->second - 1;
-        return std::make_shared<Expr>(Var{v.name, idx});
-    }
-    
-    std::shared_ptr<Expr> operator()(const Abs& a) {
-        env[a.param] = depth++;
-        auto body = convert(a.body);
-        depth--;
-        env.erase(a.param);
-        return std::make_shared<Expr>(Abs{a.param, body});
-    }
-    
-    std::shared_ptr<Expr> operator()(const App& a) {
-        auto fun = convert(a.fun);
-        auto arg = convert(a.arg);
-        return std::make_shared<Expr>(App{fun, arg});
-    }
-    
-    const std::set<std::string>& get_free_vars() const { return free_vars; }
-};
-
-// КАМ команды
-enum class CAMCommand {
-    ACCESS,
-    APPLY,
-    GRAB,
-    RETURN,
-    PUSH_CLOSURE,
-    DELAY,
-    FORCE
-};
-
-// Универсальная КАМ машина
-class CAMMachine {
-    std::vector<CAMCommand> code;
-    std::stack<int> stack;
-    std::vector<int> env;
-    std::map<std::string, int> var_map;
-
-    std::map<std::string, int> free_var_values;
-    int result;
-    int depth = 0;
-    int current_depth = 0;
-
-    bool is_lazy = false;  // По умолчанию — строгие вычисления
-public:
-    void set_lazy(bool lazy) { is_lazy = lazy; }
-    
-    struct Closure {
-        std::vector<int> captured_env;
-        size_t body_pos;
-        int index;
-        std::string repr;
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <chrono>
+
+#include "cam_new.hpp"
+
+using namespace cam_new;
+
+int main() {
+    std::vector<std::pair<std::string, std::string>> tests = {
+        {"(\\x.x) (\\y.y)", "Identity function"},
+        {"(\\x.\\y.x) a b", "K combinator"},
+        {"(\\x.\\y.y) a b", "False combinator"},
+        {"(\\f.\\x.f (f x)) (\\z.z) a", "Church numeral 2"},
+        {"(\\x.x x) (\\y.y)", "Self-application"},
+        {"(\\x.\\y.x y) (\\z.z) a", "Function application"},
+        {"(\\x.\\y.x) (\\z.z) (\\w.w w) (\\v.v v)", "Lazy evaluation (ignored w)"},
+        {"(\\x.x x) (\\y.y)", "Self-application with thunks"},
+        {"let id = \\x.x in id a", "Let binding"},
+        {"let k = \\x.\\y.x in let x = b in k x c", "Nested let with shadowing"},
+        {"letrec f = \\x.x f in f (\\g.\\y.y) b", "Letrec self-reference"}
     };
-    std::vector<Closure> closures;
-    std::stack<size_t> return_stack;
-    
-    void compile(const std::shared_ptr<Expr>& expr) {
-        std::visit(*this, *expr);
+
+    for (const auto& [input, desc] : tests) {
+        std::cout << "\n=== " << desc << " ===\n";
+        std::cout << "Expression: " << input << "\n";
+
+        try {
+            CAMMachine machine;
+            machine.load(input);
+
+            std::cout << "Compiled code: ";
+            machine.print_code();
+
+            std::cout << "Running...\n";
+            machine.run();
+            std::cout << "Result: " << machine.get_result() << "\n";
+            std::cout << "Execution completed successfully\n";
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+        }
     }
 
-private:
-    // Функции проверки комбинаторов
-    bool is_k_combinator(const std::vector<CAMCommand>& code) const {
-        // Паттерн K-комбинатора: GRAB, GRAB, ACCESS, RETURN
-        return code.size() >= 4 &&
-               code[0] == CAMCommand::GRAB &&
-               code[1] == CAMCommand::GRAB &&
-               code[2] == CAMCommand::ACCESS &&
-               code[3] == CAMCommand::RETURN;
+    // Ленивый режим: расходящийся аргумент не вычисляется
+    try {
+        CAMMachine machine;
+        machine.set_lazy(true);
+        machine.load("(\\x.\\y.y) ((\\x.x x) (\\x.x x)) a");
+        machine.run();
+        std::cout << "\n=== Lazy evaluation (omega ignored) ===\nResult: " << machine.get_result() << "\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
     }
 
-    bool is_false_combinator(const std::vector<CAMCommand>& code) const {
-        // Паттерн False-комбинатора: GRAB, GRAB, ACCESS, ACCESS, RETURN
-        return code.size() >= 5 &&
-               code[0] == CAMCommand::GRAB &&
-               code[1] == CAMCommand::GRAB &&
-               code[2] == CAMCommand::ACCESS &&
-               code[3] == CAMCommand::ACCESS &&
-               code[4] == CAMCommand::RETURN;
+    // Глубокие термы: разбор, компиляция и вывод не используют рекурсию
+    const size_t depth = 1000000;
+    std::string nested_apps, nested_lets, nested_lambdas;
+    for (size_t i = 0; i < depth; ++i) {
+        nested_apps += "(\\x.x) (";
+        nested_lets += "let x = a in ";
+        nested_lambdas += "\\x.";
     }
+    nested_apps += "a" + std::string(depth, ')');
+    nested_lets += "x";
+    nested_lambdas += "x";
 
-public:
-    void operator()(const Var& v) {
-        if (v.de_bruijn_idx == -1) {
-            // Свободная переменная
-            auto it = var_map.find(v.name);
-            if (it != var_map.end()) {
-                code.push_back(CAMCommand::PUSH_CLOSURE);
-                code.push_back(static_cast<CAMCommand>(it->second));
-            } else {
-                throw std::runtime_error("Unbound variable: " + v.name);
-            }
-        } else {
-            code.push_back(CAMCommand::ACCESS);
-            code.push_back(static_cast<CAMCommand>(v.de_bruijn_idx));
+    std::vector<std::pair<std::string, std::string>> deep_tests = {
+        {nested_apps, "Nested applications"},
+        {nested_lets, "Nested let"},
+        {nested_lambdas, "Nested lambdas"}
+    };
+    for (const auto& [input, desc] : deep_tests) {
+        try {
+            CAMMachine machine;
+            machine.load(input);
+            machine.run();
+            std::string result = machine.get_result();
+            std::cout << "\n=== " << desc << " (depth " << depth << ") ===\n";
+            std::cout << "Result: " << (result.size() > 16 ? result.substr(0, 16) + "... (" +
+                                        std::to_string(result.size()) + " bytes)" : result) << "\n";
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
         }
     }
 
-    void operator()(const Abs& a) {
-        // Сохраняем окружение для замыкания
-        std::vector<int> closure_env = env;
-        
-        env.push_back(0); 
-        
-        size_t body_start = code.size();
-        code.push_back(CAMCommand::GRAB);
-        compile(a.body);
-        code.push_back(CAMCommand::RETURN);
-
-        std::string repr;
+    // Общая прелюдия: определения компилируются один раз для всех программ
+    auto prelude = std::make_shared<Prelude>();
+    prelude->define("I", "\\x.x");
+    prelude->define("K", "\\x.\\y.x");
+    prelude->define("KI", "K I");
+    prelude->define("S", "\\f.\\g.\\x.f x (g x)");
+    prelude->define("two", "\\f.\\x.f (f x)");
+    prelude->define("fix_apply", "\\x.x fix_apply");
+    prelude->define("two_alt", "\\f.\\x.f (f x)");
+
+    // Неудачное определение не занимает слот и не сдвигает следующие
+    {
+        auto scratch = std::make_shared<Prelude>();
+        scratch->define("I", "\\x.x");
         try {
-            repr = "λ" + a.param + "." + bodyToString(a.body);
-        } catch (...) {
-            repr = "λ" + a.param + ".[...]"; 
+            scratch->define("bad", "\\x.y");
+        } catch (const std::exception& e) {
+            std::cout << "\n=== Failed prelude definition ===\n" << e.what() << "\n";
         }
-        
-        // Создаем замыкание
-        closures.push_back({
-            closure_env,
-            body_start + 1,  // Пропускаем GRAB
-            static_cast<int>(closures.size()),
-            repr
-        });
-        
-        // Вставляем PUSH_CLOSURE перед GRAB
-        code[body_start] = CAMCommand::PUSH_CLOSURE;
-        code.insert(code.begin() + body_start + 1, 
-                  static_cast<CAMCommand>(closures.size() - 1));
-        
-        current_depth--;
-        env.pop_back();
-    }
-    
-    void operator()(const App& a) {
-        if (is_lazy) {
-            code.push_back(CAMCommand::DELAY);
-            compile(a.arg);
-            compile(a.fun);
-            code.push_back(CAMCommand::APPLY);
-            code.push_back(CAMCommand::FORCE);
-        } else {
-            compile(a.arg);  
-            compile(a.fun);
-            code.push_back(CAMCommand::APPLY);
+        scratch->define("K", "\\x.\\y.x");
+        std::cout << "slots " << scratch->slots() << " for " << scratch->entries.size() << " entries\n";
+        CAMMachine machine(scratch);
+        machine.load("K a b");
+        machine.run();
+        std::cout << "K a b => " << machine.get_result() << "\n";
+        try {
+            machine.load("bad a b");
+            machine.run();
+            std::cout << "bad a b => " << machine.get_result() << " (MISMATCH)\n";
+        } catch (const std::exception& e) {
+            std::cout << "bad a b => " << e.what() << "\n";
         }
     }
-    
-    void load(const std::string& program) {
-        Parser parser(program);
-        auto ast = parser.parse_expr();
-        
-        DeBruijnConverter converter;
-        auto db_ast = converter.convert(ast);
-        
-        // Автоматическое сопоставление свободных переменных
-        const auto& free_vars = converter.get_free_vars();
-        int counter = 1;
-        for (const auto& var : free_vars) {
-            var_map[var] = counter++;
+
+    // Контрольная точка посреди вычисления: снимок пишется в файл и
+    // восстанавливается в новую машину, результат и число шагов совпадают
+    try {
+        const std::string program = "two two two two I a";
+        CAMMachine reference(prelude);
+        reference.load(program);
+        reference.run();
+
+        CAMMachine first(prelude);
+        first.load(program);
+        first.start();
+        first.resume(reference.step_count() / 2);
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<char> snapshot = first.checkpoint();
+        auto t1 = std::chrono::steady_clock::now();
+        {
+            std::ofstream out("cam_checkpoint.bin", std::ios::binary);
+            out.write(snapshot.data(), snapshot.size());
         }
-        
-        code.clear();
-        closures.clear();
-        compile(db_ast);
+
+        std::ifstream in("cam_checkpoint.bin", std::ios::binary);
+        std::vector<char> loaded((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::remove("cam_checkpoint.bin");
+
+        CAMMachine resumed(prelude);
+        resumed.load(program);
+        resumed.restore(loaded.data(), loaded.size());
+        resumed.resume(SIZE_MAX);
+
+        std::cout << "\n=== Checkpoint at step " << first.step_count() << " of " << reference.step_count() << " ===\n";
+        std::cout << "Snapshot: " << snapshot.size() << " bytes in "
+                  << std::chrono::duration<double, std::micro>(t1 - t0).count() << " us\n";
+        std::cout << "Result: " << resumed.get_result() << " after " << resumed.step_count() << " steps ("
+                  << (resumed.get_result() == reference.get_result() &&
+                      resumed.step_count() == reference.step_count() ? "matches" : "MISMATCH")
+                  << " uninterrupted run)\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
     }
-    
-    void run() {
-        size_t pc = 0;
-        env.clear();
-        stack = std::stack<int>();
-        return_stack = std::stack<size_t>();
-        result = -1; 
-        
-        // Инициализация свободных переменных
-        for (const auto& [name, val] : var_map) {
-            env.push_back(val);
-        }
-        
-        while (pc < code.size()) {
-            auto cmd = code[pc++];
-            switch (cmd) {
-                case CAMCommand::ACCESS: {
-                    int idx = static_cast<int>(code[pc++]);
-                    if (env.empty()) {
-                        // Если окружение пустое, используем значение по умолчанию
-                        stack.push(0);
-                    } 
-                    else if (idx >= 0 && idx < env.size()) {
-                        stack.push(env[env.size() - idx - 1]);
-                    }
-                    else {
-                        int safe_idx = std::min(idx, static_cast<int>(env.size()) - 1);
-                        stack.push(env[env.size() - safe_idx - 1]);
-                    }
-                    break;
-                }
-                case CAMCommand::PUSH_CLOSURE: {
-                    int idx = static_cast<int>(code[pc++]);
-                    if (idx >= 0 && idx < closures.size()) {
-                        stack.push(idx);
-                    } else {
-                        stack.push(-1);  // Невалидное замыкание
-                    }
-                    break;
-                }
-                case CAMCommand::APPLY: {
-                    if (stack.size() < 2) throw std::runtime_error("Stack underflow");
-                    int arg_thunk_idx = stack.top(); stack.pop();
-                    int closure_idx = stack.top(); stack.pop();
-                    // Применяем функцию к thunk'у (вычисление произойдет при FORCE)
-                    const auto& cl = closures[closure_idx];
-                    return_stack.push(pc);
-                    env = cl.captured_env;
-                    env.push_back(arg_thunk_idx);  
-                    pc = cl.body_pos;
-                    break;
-                }
-                case CAMCommand::GRAB: {
-                    if (stack.empty()) throw std::runtime_error("Stack underflow");
-                    int arg = stack.top(); stack.pop();
-                    env.push_back(arg);
-                    break;
-                }
-                case CAMCommand::RETURN: {
-                    if (return_stack.empty()) pc = code.size();
-                    else {
-                        pc = return_stack.top();
-                        return_stack.pop();
-                        if (!env.empty()) env.pop_back();
-                    }
-                    break;
-                }
-                case CAMCommand::DELAY: {
-                    // Сохраняем текущее окружение и позицию тела thunk'а
-                    thunks.push_back({
-                        env,            // Текущее окружение
-                        pc,             // Позиция начала тела thunk'а
-                        false,          // Флаг "не вычислено"
-                        0               // Пустое значение
-                    });
-                    pc = code.size();   // Пропускаем тело thunk'а (оно будет вычислено при FORCE)
-                    stack.push(thunks.size() - 1);  
-                    break;
-                }
-                case CAMCommand::FORCE: {
-                    if (stack.empty()) throw std::runtime_error("Stack underflow");
-                    int thunk_idx = stack.top(); stack.pop();
-                    if (thunk_idx < 0 || thunk_idx >= thunks.size()) {
-                        throw std::runtime_error("Invalid thunk index");
-                    }
-                    auto& thunk = thunks[thunk_idx];
-                    if (!thunk.evaluated) {
-                        // Вычисляем thunk
-                        return_stack.push(pc);
-                        env = thunk.saved_env;
-                        pc = thunk.body_pos;
-                        thunk.evaluated = true;
-                    } else {
-                        // Уже вычислен — берем значение
-                        stack.push(thunk.value);
-                    }
-                    break;
-                }
-            }
+
+    // Снимок программы с параметрами посреди инициализации прелюдии: входы
+    // и атомы входов едут в снимке, новая машина после load() досчитывает то же.
+    // Испорченный снимок отвергается, не трогая машину.
+    try {
+        const std::string program = "n n n I x";
+        const std::vector<std::string> params = {"n", "x"};
+        const std::vector<std::string> inputs = {"two", "q"};
+        CAMMachine reference(prelude);
+        reference.load(program, params);
+        reference.start(inputs);
+        reference.resume(SIZE_MAX);
+
+        std::cout << "\n=== Checkpoint of parameterised program (" << reference.get_result() << ") ===\n";
+        for (size_t at : {size_t(3), size_t(215), reference.step_count() - 1, reference.step_count()}) {
+            CAMMachine first(prelude);
+            first.load(program, params);
+            first.start(inputs);
+            first.resume(at);
+            std::vector<char> snapshot = first.checkpoint();
+
+            CAMMachine resumed(prelude);
+            resumed.load(program, params);
+            resumed.restore(snapshot.data(), snapshot.size());
+            resumed.resume(SIZE_MAX);
+            std::cout << "Step " << first.step_count() << ": " << resumed.get_result() << " ("
+                      << (resumed.get_result() == reference.get_result() &&
+                          resumed.step_count() == reference.step_count() ? "matches" : "MISMATCH")
+                      << ")\n";
         }
 
-        if (is_k_combinator(code)) {
-            if (env.size() >= 2) {
-                result = env[env.size() - 2]; // Первый аргумент
-            }
+        CAMMachine first(prelude);
+        first.load(program, params);
+        first.start(inputs);
+        first.resume(215);
+        std::vector<char> snapshot = first.checkpoint();
+        Snapshot::Header header;
+        std::memcpy(&header, snapshot.data(), sizeof header);
+        header.pc = SIZE_MAX;
+        std::vector<char> corrupt = snapshot;
+        std::memcpy(corrupt.data(), &header, sizeof header);
+        try {
+            CAMMachine resumed(prelude);
+            resumed.load(program, params);
+            resumed.restore(corrupt.data(), corrupt.size());
+            std::cout << "Corrupt snapshot: accepted (MISMATCH)\n";
+        } catch (const std::runtime_error& e) {
+            std::cout << "Corrupt snapshot: " << e.what() << "\n";
         }
-        else if (is_false_combinator(code)) {
-            if (!env.empty()) {
-                result = env.back(); // Последний аргумент
-            }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+
+    // Бесконечный цикл создаёт по замыканию на шаг: мусор собирается, снимок
+    // не растёт с числом шагов, а восстановленная машина продолжает тот же цикл
+    try {
+        const std::string program = "letrec f = \\x. f (\\y.y) in f a";
+        CAMMachine machine(prelude);
+        machine.load(program);
+        machine.start();
+        std::cout << "\n=== Snapshot size on a long loop ===\n";
+        size_t first_size = 0;
+        for (size_t steps : {size_t(1000000), size_t(9000000)}) {
+            machine.resume(steps);
+            std::vector<char> snapshot = machine.checkpoint();
+            if (first_size == 0) first_size = snapshot.size();
+            std::cout << "Step " << machine.step_count() << ": " << snapshot.size() << " bytes, heap "
+                      << machine.heap_size() << " ("
+                      << (snapshot.size() == first_size && machine.heap_size() < 2 * 65536 ? "bounded" : "MISMATCH")
+                      << ")\n";
         }
 
+        std::vector<char> snapshot = machine.checkpoint();
+        CAMMachine resumed(prelude);
+        resumed.load(program);
+        resumed.restore(snapshot.data(), snapshot.size());
+        resumed.resume(1000000);
+        machine.resume(1000000);
+        std::cout << "Restored: step " << resumed.step_count() << ", heap " << resumed.heap_size() << " ("
+                  << (resumed.step_count() == machine.step_count() &&
+                      resumed.checkpoint() == machine.checkpoint() ? "matches" : "MISMATCH")
+                  << ")\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
     }
-    
-    std::string get_result() const {
-        using std::to_string;
-        using std::string;
-
-        // 1. Если результат был явно установлен (например, для K- и False-комбинаторов)
-        if (result != -1) {
-            // Проверяем, является ли результат свободной переменной
-            for (const auto& [name, val] : var_map) {
-                if (val == result) {
-                    return name;  
-                }
-            }
-            // Если это символ (ASCII)
-            if (result > 0 && result < 128) {
-                return "'" + string(1, (char)result) + "'";
-            }
-            return to_string(result);
-        }
 
-        // 2. Проверяем стек
-        if (!stack.empty()) {
-            int res = stack.top();
-            // Проверяем, является ли результат свободной переменной
-            for (const auto& [name, val] : var_map) {
-                if (val == res) {
-                    return name;
-                }
-            }
-            // Если это замыкание
-            for (const auto& cl : closures) {
-                if (cl.index == res) {
-                    return cl.repr;
-                }
-            }
-            // Если это символ (ASCII)
-            if (res > 0 && res < 128) {
-                return "'" + string(1, (char)res) + "'";
-            }
-            return to_string(res);
+    // Пакетный режим: одна программа над многими входами в ногу против отдельных машин.
+    // В смешанном пакете половина дорожек получает two_alt — другое тело, дорожки расходятся.
+    try {
+        const std::string program = "n n n n I x";
+        const std::vector<std::string> params = {"n", "x"};
+        const size_t lanes = 64;
+        std::vector<std::vector<std::string>> uniform_inputs, mixed_inputs;
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            std::string x = "x" + std::to_string(lane % 8);
+            uniform_inputs.push_back({"two", x});
+            mixed_inputs.push_back({lane % 2 ? "two_alt" : "two", x});
         }
 
-        // 3. Проверяем окружение
-        if (!env.empty()) {
-            int res = env.back();
-            for (const auto& [name, val] : var_map) {
-                if (val == res) {
-                    return name;
-                }
-            }
-            for (const auto& cl : closures) {
-                if (cl.index == res) {
-                    return cl.repr;
-                }
+        for (const auto* inputs : {&uniform_inputs, &mixed_inputs}) {
+            std::vector<CAMMachine> machines(lanes, CAMMachine(prelude));
+            for (auto& machine : machines) machine.load(program, params);
+            std::vector<std::string> scalar_results;
+            size_t scalar_total = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                machines[lane].start((*inputs)[lane]);
+                machines[lane].resume(SIZE_MAX);
+                scalar_results.push_back(machines[lane].get_result());
+                scalar_total += machines[lane].step_count();
             }
-            if (res > 0 && res < 128) {
-                return "'" + string(1, (char)res) + "'";
-            }
-            return to_string(res);
-        }
+            auto t1 = std::chrono::steady_clock::now();
 
-        return "No result";
-    }
+            BatchMachine batch(prelude);
+            batch.load(program, params);
+            auto t2 = std::chrono::steady_clock::now();
+            auto batch_results = batch.run(*inputs);
+            auto t3 = std::chrono::steady_clock::now();
 
-    void print_code() const {
-        for (auto cmd : code) {
-            switch (cmd) {
-                case CAMCommand::ACCESS: std::cout << "ACCESS "; break;
-                case CAMCommand::APPLY: std::cout << "APPLY "; break;
-                case CAMCommand::GRAB: std::cout << "GRAB "; break;
-                case CAMCommand::RETURN: std::cout << "RETURN "; break;
-                case CAMCommand::PUSH_CLOSURE: std::cout << "PUSH_CLOSURE "; break;
-            }
+            double scalar_s = std::chrono::duration<double>(t1 - t0).count();
+            double batch_s = std::chrono::duration<double>(t3 - t2).count();
+            std::cout << "\n=== Batch of " << lanes << " lanes (" << (inputs == &uniform_inputs ? "uniform" : "mixed")
+                      << " inputs, " << batch.diverged_lanes() << " diverged) ===\n";
+            std::cout << "Separate machines: " << scalar_s * 1000 << " ms, "
+                      << scalar_total / scalar_s / 1e6 << " M lane-steps/s\n";
+            std::cout << "Lockstep batch:    " << batch_s * 1000 << " ms, "
+                      << scalar_total / batch_s / 1e6 << " M lane-steps/s ("
+                      << batch.lockstep_steps() << " lockstep + " << batch.diverged_steps() << " scalar steps)\n";
+            std::cout << "Results " << (batch_results == scalar_results ? "match" : "MISMATCH") << "\n";
         }
-        std::cout << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
     }
 
-    std::string bodyToString(const std::shared_ptr<Expr>& expr) {
-        auto visitor = overloaded {
-            [](const Var& v) -> std::string { return v.name; },
-            [this](const Abs& a) -> std::string { 
-                return "λ" + a.param + "." + this->bodyToString(a.body);
-            },
-            [this](const App& a) -> std::string {
-                return this->bodyToString(a.fun) + " " + this->bodyToString(a.arg);
+    // Интерактивный сеанс: каждое определение компилируется отдельно и
+    // дописывается к коду, время ввода не растёт с числом прежних определений
+    try {
+        CAMMachine session(prelude);
+        session.begin_session();
+        session.define("id", "\\x.x");
+        session.define("pair", "\\a.\\b.\\s.s a b");
+        session.define("first", "\\p.p K");
+        std::cout << "\n=== Session ===\n";
+        std::cout << "first (pair a b) => " << session.eval("first (pair a b)") << "\n";
+        session.define("id", "\\x.K x x");
+        std::cout << "id (pair a b) KI => " << session.eval("id (pair a b) KI") << "\n";
+
+        // Ошибочный ввод не портит сеанс: сегмент и имена остаются прежними
+        size_t segment_before = session.code_size();
+        for (auto [name, source] : {std::pair<std::string, std::string>{"", "letrec f = a in f"},
+                                    {"g", "(a"}}) {
+            try {
+                if (name.empty()) session.eval(source);
+                else session.define(name, source);
+                std::cout << source << " => accepted (MISMATCH)\n";
+            } catch (const std::exception& e) {
+                std::cout << source << " => " << e.what() << "\n";
             }
-        };
-        return std::visit(visitor, *expr);
+        }
+        std::cout << "Segment " << (session.code_size() == segment_before ? "kept" : "CHANGED")
+                  << ", g => " << session.eval("g") << ", K (id a) b => " << session.eval("K (id a) b") << "\n";
+
+        const int definitions = 2000;
+        double first_ms = 0, last_ms = 0;
+        for (int i = 0; i < definitions; ++i) {
+            std::string name = "f" + std::to_string(i);
+            std::string prev = i ? "f" + std::to_string(i - 1) : "id";
+            auto t0 = std::chrono::steady_clock::now();
+            session.define(name, "\\x." + prev + " (id x)");
+            auto t1 = std::chrono::steady_clock::now();
+            double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+            if (i < 100) first_ms += ms;
+            if (i >= definitions - 100) last_ms += ms;
+        }
+        std::cout << "f" << definitions - 1 << " c => " << session.eval("f" + std::to_string(definitions - 1) + " c") << "\n";
+        std::cout << "Define latency: first 100 " << first_ms / 100 << " ms, last 100 " << last_ms / 100
+                  << " ms (" << session.code_size() << " commands in segment)\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
     }
-};
 
-int main() {
-    std::vector<std::pair<std::string, std::string>> tests = {
-        {"(\\x.x) (\\y.y)", "Identity function"},
-        {"(\\x.\\y.x) a b", "K combinator"},
-        {"(\\x.\\y.y) a b", "False combinator"},
-        {"(\\f.\\x.f (f x)) (\\z.z) a", "Church numeral 2"},
-        {"(\\x.x x) (\\y.y)", "Self-application"},
-        {"(\\x.\\y.x y) (\\z.z) a", "Function application"},
-        {"(\\x.\\y.x) (\\z.z) (\\w.w w) (\\v.v v)", "Lazy evaluation (ignored w)"},
-        {"(\\x.x x) (\\y.y)", "Self-application with thunks"}
+    std::vector<std::pair<std::string, std::string>> prelude_tests = {
+        {"K a b", "a"},
+        {"KI a b", "b"},
+        {"S K K a", "a"},
+        {"two I a", "a"},
+        {"fix_apply (\\g.\\y.y) b", "b"},
+        {"let twice = two in twice (K a) b", "a"}
     };
 
-    for (const auto& [input, desc] : tests) {
-        std::cout << "\n=== " << desc << " ===\n";
-        std::cout << "Expression: " << input << "\n";
-        
+    std::cout << "\n=== Prelude (" << prelude->segment.code.size() << " shared commands) ===\n";
+    for (const auto& [input, expected] : prelude_tests) {
         try {
-            CAMMachine machine;
+            CAMMachine machine(prelude);
             machine.load(input);
-            
-            std::cout << "Compiled code: ";
-            machine.print_code();
-            
-            std::cout << "Running...\n";
             machine.run();
-            std::cout << "Result: " << machine.get_result() << "\n";
-            std::cout << "Execution completed successfully\n";
+            std::cout << input << " => " << machine.get_result()
+                      << " (expected " << expected << ", program code " << machine.code_size() << ")\n";
         } catch (const std::exception& e) {
             std::cerr << "Error: " << e.what() << "\n";
         }
     }
-    
+
     return 0;
-}
\ No newline at end of file
+}
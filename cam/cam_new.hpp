@@ -0,0 +1,1772 @@
+#ifndef CAM_NEW_H
+#define CAM_NEW_H
+
+// Машина cam_new: разбор, компиляция в код КАМ, CAMMachine, прелюдия и пакетный режим.
+// Всё лежит в пространстве имён cam_new: имена Expr, App, CAMMachine совпадают с cam.hpp и cam2.hpp
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <variant>
+#include <stdexcept>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace cam_new {
+
+// AST типы
+struct Var;
+struct Abs;
+struct App;
+struct Let;
+using Expr = std::variant<Var, Abs, App, Let>;
+
+// Освобождает поддерево без рекурсии: узлы, которые больше никому не нужны,
+// разбираются в цикле, иначе глубокие термы переполняют стек деструкторами
+inline void release_expr(std::shared_ptr<Expr>& node);
+
+struct Var {
+    std::string name;
+    int de_bruijn_idx;
+};
+
+struct Abs {
+    std::string param;
+    std::shared_ptr<Expr> body;
+    ~Abs();
+};
+
+struct App {
+    std::shared_ptr<Expr> fun;
+    std::shared_ptr<Expr> arg;
+    ~App();
+};
+
+// let x = value in body / letrec x = value in body
+struct Let {
+    std::string name;
+    std::shared_ptr<Expr> value;
+    std::shared_ptr<Expr> body;
+    bool recursive;
+    ~Let();
+};
+
+inline Abs::~Abs() { release_expr(body); }
+inline App::~App() { release_expr(fun); release_expr(arg); }
+inline Let::~Let() { release_expr(value); release_expr(body); }
+
+inline void release_expr(std::shared_ptr<Expr>& node) {
+    static std::vector<std::shared_ptr<Expr>>* pending = nullptr;
+    if (!node || node.use_count() != 1) {
+        node.reset();
+        return;
+    }
+    // Уже внутри цикла освобождения — откладываем узел
+    if (pending) {
+        pending->push_back(std::move(node));
+        return;
+    }
+    std::vector<std::shared_ptr<Expr>> work;
+    pending = &work;
+    work.push_back(std::move(node));
+    while (!work.empty()) {
+        auto next = std::move(work.back());
+        work.pop_back();
+        next.reset();
+    }
+    pending = nullptr;
+}
+
+struct Thunk {
+    std::vector<int> saved_env;
+    size_t body_pos;
+    bool evaluated = false;
+    int value;
+};
+
+template<class... Ts>
+struct overloaded : Ts... { using Ts::operator()...; };
+template<class... Ts>
+overloaded(Ts...) -> overloaded<Ts...>;
+
+// Разбор без рекурсии: вложенные конструкции (лямбда, let, скобки)
+// хранятся в явном стеке фреймов, каждый собирает свою цепочку применений
+class Parser {
+    std::string input;
+    size_t pos = 0;
+    std::set<std::string> bound_vars;
+    std::set<std::string> free_vars;
+
+    enum class FrameKind { ROOT, PAREN, LAMBDA, LET_VALUE, LET_BODY };
+
+    struct Frame {
+        FrameKind kind;
+        std::shared_ptr<Expr> left;     // накопленное применение
+        std::string name;               // параметр лямбды или имя let
+        bool was_bound = false;
+        bool recursive = false;
+        std::shared_ptr<Expr> value;    // значение let для LET_BODY
+    };
+
+    void skip_whitespace() {
+        while (pos < input.size() && isspace(input[pos])) pos++;
+    }
+
+    char peek() {
+        skip_whitespace();
+        return pos < input.size() ? input[pos] : '\0';
+    }
+
+    char consume() {
+        skip_whitespace();
+        return pos < input.size() ? input[pos++] : '\0';
+    }
+
+    bool is_ident_char(char c) const {
+        return isalpha(c) || isdigit(c) || c == '_';
+    }
+
+    // Ключевое слово должно стоять целиком, а не быть префиксом идентификатора
+    bool peek_keyword(const std::string& kw) {
+        skip_whitespace();
+        if (input.compare(pos, kw.size(), kw) != 0) return false;
+        size_t end = pos + kw.size();
+        return end >= input.size() || !is_ident_char(input[end]);
+    }
+
+    bool peek_let() {
+        return peek_keyword("let") || peek_keyword("letrec");
+    }
+
+    bool at_app_end() {
+        return peek() == '\0' || peek() == ')' || peek_keyword("in");
+    }
+
+    std::string parse_identifier() {
+        skip_whitespace();
+        std::string id;
+        while (pos < input.size() && is_ident_char(input[pos])) {
+            id += input[pos++];
+        }
+        return id;
+    }
+
+    // Связывает имя на время разбора тела; возвращает, было ли оно уже связано
+    bool bind(const std::string& name) {
+        return !bound_vars.insert(name).second;
+    }
+
+    void unbind(const std::string& name, bool was_bound) {
+        if (!was_bound) bound_vars.erase(name);
+    }
+
+    // Открывает фрейм для конструкции, начинающейся в позиции атома.
+    // Возвращает готовый атом, если это переменная.
+    std::shared_ptr<Expr> open_atom(std::vector<Frame>& frames) {
+        if (peek() == '\\') {
+            consume();
+            std::string param = parse_identifier();
+            if (peek() != '.') throw std::runtime_error("Expected '.'");
+            consume();
+            bool was_bound = bind(param);
+            frames.push_back({FrameKind::LAMBDA, nullptr, param, was_bound, false, nullptr});
+            return nullptr;
+        }
+        if (peek_let()) {
+            bool recursive = parse_identifier() == "letrec";
+            std::string name = parse_identifier();
+            if (name.empty()) throw std::runtime_error("Expected identifier after let");
+            if (peek() != '=') throw std::runtime_error("Expected '='");
+            consume();
+            bool was_bound = recursive ? bind(name) : bound_vars.count(name) > 0;
+            frames.push_back({FrameKind::LET_VALUE, nullptr, name, was_bound, recursive, nullptr});
+            return nullptr;
+        }
+        if (peek() == '(') {
+            consume();
+            frames.push_back({FrameKind::PAREN, nullptr, "", false, false, nullptr});
+            return nullptr;
+        }
+
+        std::string name = parse_identifier();
+        if (name.empty()) throw std::runtime_error("Expected identifier");
+
+        // Если переменная не связана, добавляем в свободные
+        if (bound_vars.find(name) == bound_vars.end()) {
+            free_vars.insert(name);
+        }
+
+        return std::make_shared<Expr>(Var{name, -1});
+    }
+
+public:
+    Parser(const std::string& input) : input(input) {}
+
+    std::shared_ptr<Expr> parse_expr() {
+        std::vector<Frame> frames;
+        frames.push_back({FrameKind::ROOT, nullptr, "", false, false, nullptr});
+
+        while (true) {
+            auto atom = open_atom(frames);
+            if (!atom) continue;
+
+            // Атом готов: добавляем в применение верхнего фрейма и закрываем
+            // все конструкции, которые на этом заканчиваются
+            while (true) {
+                Frame& top = frames.back();
+                top.left = top.left ? std::make_shared<Expr>(App{top.left, atom}) : atom;
+                if (!at_app_end()) break;
+
+                Frame done = std::move(frames.back());
+                frames.pop_back();
+                switch (done.kind) {
+                    case FrameKind::ROOT:
+                        return done.left;
+                    case FrameKind::PAREN:
+                        if (peek() != ')') throw std::runtime_error("Expected ')'");
+                        consume();
+                        atom = done.left;
+                        break;
+                    case FrameKind::LAMBDA:
+                        unbind(done.name, done.was_bound);
+                        atom = std::make_shared<Expr>(Abs{done.name, done.left});
+                        break;
+                    case FrameKind::LET_VALUE:
+                        if (!peek_keyword("in")) throw std::runtime_error("Expected 'in'");
+                        parse_identifier();
+                        if (!done.recursive) done.was_bound = bind(done.name);
+                        frames.push_back({FrameKind::LET_BODY, nullptr, done.name,
+                                          done.was_bound, done.recursive, done.left});
+                        atom = nullptr;
+                        break;
+                    case FrameKind::LET_BODY:
+                        unbind(done.name, done.was_bound);
+                        atom = std::make_shared<Expr>(Let{done.name, done.value, done.left, done.recursive});
+                        break;
+                }
+                if (!atom) break;
+            }
+        }
+    }
+
+    // Разбор всей программы: после выражения не должно остаться символов
+    std::shared_ptr<Expr> parse_program() {
+        auto expr = parse_expr();
+        if (peek() != '\0') throw std::runtime_error("Unexpected input at position " + std::to_string(pos));
+        return expr;
+    }
+
+    const std::set<std::string>& get_free_vars() const { return free_vars; }
+};
+
+// Преобразователь в де Брауновский индекс.
+// Обход в глубину с явным стеком: узел посещается до и после своих детей.
+class DeBruijnConverter {
+    std::map<std::string, std::vector<int>> env;   // имя -> глубины связываний
+    int depth = 0;
+    std::set<std::string> free_vars;
+
+    void bind(const std::string& name) { env[name].push_back(depth++); }
+
+    void unbind(const std::string& name) {
+        depth--;
+        auto it = env.find(name);
+        it->second.pop_back();
+        if (it->second.empty()) env.erase(it);
+    }
+
+public:
+    std::shared_ptr<Expr> convert(const std::shared_ptr<Expr>& root) {
+        struct Task {
+            const Expr* node;
+            int stage;
+        };
+        std::vector<Task> tasks{{root.get(), 0}};
+        std::vector<std::shared_ptr<Expr>> results;
+
+        auto pop_result = [&] {
+            auto r = std::move(results.back());
+            results.pop_back();
+            return r;
+        };
+
+        while (!tasks.empty()) {
+            Task task = tasks.back();
+            tasks.pop_back();
+            const Expr& node = *task.node;
+
+            if (auto v = std::get_if<Var>(&node)) {
+                auto it = env.find(v->name);
+                if (it == env.end()) {
+                    free_vars.insert(v->name);
+                    results.push_back(std::make_shared<Expr>(Var{v->name, -1}));
+                } else {
+                    int idx = depth - it->second.back() - 1;
+                    results.push_back(std::make_shared<Expr>(Var{v->name, idx}));
+                }
+            } else if (auto a = std::get_if<Abs>(&node)) {
+                if (task.stage == 0) {
+                    bind(a->param);
+                    tasks.push_back({task.node, 1});
+                    tasks.push_back({a->body.get(), 0});
+                } else {
+                    unbind(a->param);
+                    results.push_back(std::make_shared<Expr>(Abs{a->param, pop_result()}));
+                }
+            } else if (auto a = std::get_if<App>(&node)) {
+                if (task.stage == 0) {
+                    tasks.push_back({task.node, 1});
+                    tasks.push_back({a->arg.get(), 0});
+                    tasks.push_back({a->fun.get(), 0});
+                } else {
+                    auto arg = pop_result();
+                    auto fun = pop_result();
+                    results.push_back(std::make_shared<Expr>(App{fun, arg}));
+                }
+            } else if (auto l = std::get_if<Let>(&node)) {
+                if (task.stage == 0) {
+                    if (l->recursive) bind(l->name);
+                    tasks.push_back({task.node, 1});
+                    tasks.push_back({l->value.get(), 0});
+                } else if (task.stage == 1) {
+                    if (!l->recursive) bind(l->name);
+                    tasks.push_back({task.node, 2});
+                    tasks.push_back({l->body.get(), 0});
+                } else {
+                    unbind(l->name);
+                    auto body = pop_result();
+                    auto value = pop_result();
+                    results.push_back(std::make_shared<Expr>(Let{l->name, value, body, l->recursive}));
+                }
+            }
+        }
+        return pop_result();
+    }
+
+    // Параметры программы: связаны снаружи всех лямбд, первый — самый глубокий
+    void bind_params(const std::vector<std::string>& params) {
+        for (const auto& param : params) bind(param);
+    }
+
+    const std::set<std::string>& get_free_vars() const { return free_vars; }
+};
+
+// Текстовое представление терма; части выводятся из явного стека
+inline std::string bodyToString(const std::shared_ptr<Expr>& expr) {
+    struct Part {
+        const Expr* node;
+        std::string text;
+    };
+    std::string out;
+    std::vector<Part> parts{{expr.get(), {}}};
+
+    while (!parts.empty()) {
+        Part part = std::move(parts.back());
+        parts.pop_back();
+        if (!part.node) {
+            out += part.text;
+            continue;
+        }
+        std::visit(overloaded {
+            [&](const Var& v) { out += v.name; },
+            [&](const Abs& a) {
+                parts.push_back({a.body.get(), {}});
+                out += "λ" + a.param + ".";
+            },
+            [&](const App& a) {
+                parts.push_back({a.arg.get(), {}});
+                parts.push_back({nullptr, " "});
+                parts.push_back({a.fun.get(), {}});
+            },
+            [&](const Let& l) {
+                parts.push_back({l.body.get(), {}});
+                parts.push_back({nullptr, " in "});
+                parts.push_back({l.value.get(), {}});
+                out += std::string(l.recursive ? "letrec " : "let ") + l.name + " = ";
+            }
+        }, *part.node);
+    }
+    return out;
+}
+
+// КАМ команды
+enum class CAMCommand {
+    ACCESS,
+    APPLY,
+    GRAB,
+    RETURN,
+    PUSH_CLOSURE,
+    DELAY,
+    FORCE,
+    CONST,       // свободная переменная (атом)
+    GLOBAL,      // определение из прелюдии
+    SET_GLOBAL,
+    BIND,        // let: значение со стека в окружение
+    UNBIND,
+    DUMMY,       // letrec: зарезервировать слот окружения
+    FIX          // letrec: замкнуть слот на вычисленное значение
+};
+
+// Значение машины — int с тегом в младших двух битах
+enum class ValueTag { CLOSURE = 0, ATOM = 1, THUNK = 2 };
+
+// Под номер в куче или таблице thunk'ов остаётся 29 бит
+constexpr int MAX_VALUE_PAYLOAD = (1 << 29) - 1;
+
+inline int make_value(ValueTag tag, int payload) {
+    if (payload < 0 || payload > MAX_VALUE_PAYLOAD) {
+        throw std::overflow_error("Value payload out of range: heap or thunk table exceeds 2^29 entries");
+    }
+    return (payload << 2) | static_cast<int>(tag);
+}
+inline ValueTag value_tag(int value) { return static_cast<ValueTag>(value & 3); }
+inline int value_payload(int value) { return value >> 2; }
+
+// Замыкание: в таблице сегмента — шаблон (тело и исходный терм), в куче — с окружением.
+// Текст замыкания строится по source только при выводе результата.
+// Шаблон помнит, сколько верхних слотов окружения читает тело: захватываются только они,
+// иначе каждое замыкание держит всё окружение создавшего его кода вместе с мусором.
+struct Closure {
+    std::vector<int> captured_env;
+    size_t body_pos;
+    int index;
+    std::shared_ptr<Expr> source;
+    size_t captured_depth = 0;
+
+    std::string repr() const { return source ? bodyToString(source) : "<closure>"; }
+};
+
+// Сегмент кода: команды с операндами и таблица замыканий
+struct CodeSegment {
+    std::vector<CAMCommand> code;
+    std::vector<Closure> closures;
+};
+
+// Компилятор AST с индексами де Брауна в сегмент кода.
+// Тела лямбд и отложенных аргументов выносятся за конец основного кода,
+// адреса и номера замыканий смещаются на базу сегмента.
+// Обход идёт по явному стеку задач: узел для компиляции или готовая команда.
+class Compiler {
+    CodeSegment& segment;
+    size_t code_base;
+    size_t closure_base;
+    const std::map<std::string, int>& globals;
+    const std::map<std::string, int>& atoms;
+    bool is_lazy;
+
+    struct Pending {
+        size_t closure;
+        std::shared_ptr<Expr> body;
+        bool grab;
+    };
+    std::vector<Pending> pending;
+
+    struct Task {
+        const std::shared_ptr<Expr>* expr;  // nullptr — выдать команду cmd
+        CAMCommand cmd;
+    };
+    std::vector<Task> tasks;
+
+    // Для каждого узла: сколько верхних слотов окружения он читает
+    std::unordered_map<const Expr*, size_t> scope;
+
+    // Обход в обратном порядке по явному стеку: узел считается после детей
+    void measure_scope(const std::shared_ptr<Expr>& root) {
+        std::vector<std::pair<const Expr*, bool>> work{{root.get(), false}};
+        auto under_binder = [&](const std::shared_ptr<Expr>& e) {
+            size_t depth = scope.at(e.get());
+            return depth > 0 ? depth - 1 : 0;
+        };
+        while (!work.empty()) {
+            auto [node, children_done] = work.back();
+            work.pop_back();
+            if (scope.count(node)) continue;
+            if (!children_done) {
+                work.push_back({node, true});
+                std::visit(overloaded {
+                    [&](const Var&) {},
+                    [&](const Abs& a) { work.push_back({a.body.get(), false}); },
+                    [&](const App& a) {
+                        work.push_back({a.fun.get(), false});
+                        work.push_back({a.arg.get(), false});
+                    },
+                    [&](const Let& l) {
+                        work.push_back({l.value.get(), false});
+                        work.push_back({l.body.get(), false});
+                    }
+                }, *node);
+                continue;
+            }
+            scope[node] = std::visit(overloaded {
+                [&](const Var& v) { return v.de_bruijn_idx >= 0 ? size_t(v.de_bruijn_idx) + 1 : size_t(0); },
+                [&](const Abs& a) { return under_binder(a.body); },
+                [&](const App& a) { return std::max(scope.at(a.fun.get()), scope.at(a.arg.get())); },
+                [&](const Let& l) {
+                    size_t value = l.recursive ? under_binder(l.value) : scope.at(l.value.get());
+                    return std::max(value, under_binder(l.body));
+                }
+            }, *node);
+        }
+    }
+
+    void emit(CAMCommand cmd) { segment.code.push_back(cmd); }
+    void emit(CAMCommand cmd, int operand) {
+        segment.code.push_back(cmd);
+        segment.code.push_back(static_cast<CAMCommand>(operand));
+    }
+
+    int add_block(const std::shared_ptr<Expr>& source, const std::shared_ptr<Expr>& body, bool grab) {
+        size_t local = segment.closures.size();
+        int index = static_cast<int>(closure_base + local);
+        segment.closures.push_back({{}, 0, index, source, scope.at(source.get())});
+        pending.push_back({local, body, grab});
+        return index;
+    }
+
+    void compile_var(const Var& v) {
+        if (v.de_bruijn_idx != -1) {
+            emit(CAMCommand::ACCESS, v.de_bruijn_idx);
+            if (is_lazy) emit(CAMCommand::FORCE);
+            return;
+        }
+        if (auto g = globals.find(v.name); g != globals.end()) {
+            emit(CAMCommand::GLOBAL, g->second);
+        } else if (auto a = atoms.find(v.name); a != atoms.end()) {
+            emit(CAMCommand::CONST, a->second);
+        } else {
+            throw std::runtime_error("Unbound variable: " + v.name);
+        }
+    }
+
+public:
+    Compiler(CodeSegment& segment, size_t code_base, size_t closure_base,
+             const std::map<std::string, int>& globals,
+             const std::map<std::string, int>& atoms, bool is_lazy)
+        : segment(segment), code_base(code_base), closure_base(closure_base),
+          globals(globals), atoms(atoms), is_lazy(is_lazy) {}
+
+    // Компилирует выражение; код завершается командами tail и RETURN.
+    // Возвращает адрес точки входа.
+    size_t compile_entry(const std::shared_ptr<Expr>& expr,
+                         const std::vector<std::pair<CAMCommand, int>>& tail = {}) {
+        size_t entry = code_base + segment.code.size();
+        measure_scope(expr);
+        compile(expr);
+        for (const auto& [cmd, operand] : tail) emit(cmd, operand);
+        emit(CAMCommand::RETURN);
+
+        while (!pending.empty()) {
+            Pending p = std::move(pending.back());
+            pending.pop_back();
+            segment.closures[p.closure].body_pos = code_base + segment.code.size();
+            if (p.grab) emit(CAMCommand::GRAB);
+            compile(p.body);
+            emit(CAMCommand::RETURN);
+        }
+        return entry;
+    }
+
+    void compile(const std::shared_ptr<Expr>& root) {
+        tasks.push_back({&root, {}});
+        while (!tasks.empty()) {
+            Task task = tasks.back();
+            tasks.pop_back();
+            if (!task.expr) {
+                emit(task.cmd);
+                continue;
+            }
+            const auto& expr = *task.expr;
+            std::visit(overloaded {
+                [&](const Var& v) { compile_var(v); },
+                [&](const Abs& a) {
+                    emit(CAMCommand::PUSH_CLOSURE, add_block(expr, a.body, true));
+                },
+                [&](const App& a) {
+                    // Задачи выполняются в обратном порядке: аргумент, функция, APPLY
+                    tasks.push_back({nullptr, CAMCommand::APPLY});
+                    tasks.push_back({&a.fun, {}});
+                    if (is_lazy) {
+                        emit(CAMCommand::DELAY, add_block(a.arg, a.arg, false));
+                    } else {
+                        tasks.push_back({&a.arg, {}});
+                    }
+                },
+                [&](const Let& l) {
+                    tasks.push_back({nullptr, CAMCommand::UNBIND});
+                    tasks.push_back({&l.body, {}});
+                    if (l.recursive) {
+                        if (!std::holds_alternative<Abs>(*l.value)) {
+                            throw std::runtime_error("letrec expects a lambda: " + l.name);
+                        }
+                        tasks.push_back({nullptr, CAMCommand::FIX});
+                        tasks.push_back({&l.value, {}});
+                        emit(CAMCommand::DUMMY);
+                    } else {
+                        tasks.push_back({nullptr, CAMCommand::BIND});
+                        tasks.push_back({&l.value, {}});
+                    }
+                }
+            }, *expr);
+        }
+    }
+};
+
+// Прелюдия: общие определения верхнего уровня.
+// Каждое определение компилируется один раз в общий сегмент,
+// программы машин ссылаются на него через GLOBAL без перекомпиляции.
+class Prelude {
+    bool is_lazy = false;
+public:
+    CodeSegment segment;
+    std::map<std::string, int> globals;   // имя -> слот
+    std::vector<size_t> entries;          // код инициализации слотов по порядку
+
+    void set_lazy(bool lazy) { is_lazy = lazy; }
+
+    // Определение может ссылаться на себя и на предыдущие определения.
+    // Слот публикуется только после удачной компиляции: при ошибке прелюдия не меняется
+    void define(const std::string& name, const std::string& source) {
+        Parser parser(source);
+        DeBruijnConverter converter;
+        auto db_ast = converter.convert(parser.parse_program());
+
+        for (const auto& var : converter.get_free_vars()) {
+            if (var != name && globals.find(var) == globals.end()) {
+                throw std::runtime_error("Unbound variable in prelude definition " + name + ": " + var);
+            }
+        }
+
+        auto it = globals.find(name);
+        bool is_new = it == globals.end();
+        int slot = is_new ? static_cast<int>(globals.size()) : it->second;
+        if (is_new) globals[name] = slot;
+
+        size_t code_size = segment.code.size();
+        size_t closure_count = segment.closures.size();
+        try {
+            std::map<std::string, int> no_atoms;
+            Compiler compiler(segment, 0, 0, globals, no_atoms, is_lazy);
+            entries.push_back(compiler.compile_entry(db_ast, {{CAMCommand::SET_GLOBAL, slot}}));
+        } catch (...) {
+            segment.code.erase(segment.code.begin() + code_size, segment.code.end());
+            segment.closures.erase(segment.closures.begin() + closure_count, segment.closures.end());
+            if (is_new) globals.erase(name);
+            throw;
+        }
+    }
+
+    size_t slots() const { return globals.size(); }
+};
+
+// Снимок состояния машины: заголовок фиксированного размера и секции плоских записей.
+// Смещения отсчитываются от начала буфера, секции выровнены на 8 байт,
+// окружения лежат одним пулом — снимок можно читать из отображённого в память файла.
+// Входы программы и таблица атомов хранятся по именам: имена лежат пулом NAMES.
+struct Snapshot {
+    static constexpr uint32_t MAGIC = 0x534D4143;   // "CAMS"
+    static constexpr uint32_t VERSION = 2;
+
+    enum SectionId { STACK, ENV, GLOBALS, FRAMES, CLOSURES, THUNKS, ENV_POOL,
+                     INPUTS, ATOMS, NAMES, SECTION_COUNT };
+
+    struct Section {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t code_hash;
+        uint64_t pc;
+        uint64_t current_entry;
+        uint64_t steps;
+        uint64_t halted;
+        Section sections[SECTION_COUNT];
+    };
+
+    // Окружение — отрезок пула ENV_POOL
+    struct EnvRef {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct FrameRecord {
+        uint64_t pc;
+        EnvRef env;
+        int32_t update_thunk;
+        int32_t reserved;
+    };
+
+    struct ClosureRecord {
+        uint64_t body_pos;
+        EnvRef env;
+        int32_t index;
+        int32_t reserved;
+    };
+
+    struct ThunkRecord {
+        uint64_t body_pos;
+        EnvRef env;
+        int32_t evaluated;
+        int32_t value;
+    };
+
+    // Имя — отрезок пула NAMES
+    struct NameRef {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct AtomRecord {
+        NameRef name;
+        int32_t id;
+        int32_t reserved;
+    };
+};
+
+static_assert(sizeof(int) == sizeof(int32_t), "snapshot stores machine values as int32");
+
+// Универсальная КАМ машина
+class CAMMachine {
+    std::vector<CAMCommand> code;
+    std::vector<int> stack;
+    std::vector<int> env;
+    std::map<std::string, int> var_map;
+
+    std::shared_ptr<const Prelude> prelude;
+    size_t code_base = 0;
+    size_t closure_base = 0;
+    size_t entry = 0;
+
+    std::vector<int> globals;
+    std::vector<Closure> heap;    // замыкания, созданные во время исполнения
+    std::vector<Thunk> thunks;    // Хранилище thunk'ов
+
+    // Куча и thunk'и уплотняются, когда вместе дорастают до collect_at записей;
+    // порог — удвоенный объём живых записей после прошлой сборки
+    static constexpr size_t MIN_COLLECT = 1 << 16;
+    size_t collect_at = MIN_COLLECT;
+
+    // Точка исполнения: сначала инициализация прелюдии, затем программа
+    size_t pc = 0;
+    size_t current_entry = 0;
+    size_t steps = 0;
+    bool halted = true;
+
+    // Параметры программы и их значения (имена определений прелюдии или атомов)
+    std::vector<std::string> params;
+    std::vector<std::string> inputs;
+
+    // Глобальные имена: определения прелюдии и сеанса
+    std::map<std::string, int> session_globals;
+
+    bool is_lazy = false;  // По умолчанию — строгие вычисления
+
+    friend class BatchMachine;
+public:
+    CAMMachine() = default;
+    explicit CAMMachine(std::shared_ptr<const Prelude> prelude) : prelude(std::move(prelude)) {}
+
+    void set_lazy(bool lazy) { is_lazy = lazy; }
+
+    struct Frame {
+        size_t pc;
+        std::vector<int> env;
+        int update_thunk;   // индекс вычисляемого thunk'а или -1
+    };
+    std::vector<Closure> closures;
+    std::vector<Frame> return_stack;
+
+    // Параметры params образуют начальное окружение программы,
+    // их значения передаются в start()
+    void load(const std::string& program, const std::vector<std::string>& params = {}) {
+        code.clear();
+        closures.clear();
+        var_map.clear();
+        reset_segment();
+        this->params = params;
+        entry = compile_input(program, params, {});
+    }
+
+    // Интерактивный сеанс: определения и выражения дописываются в конец
+    // сегмента кода и таблицы замыканий, прежний код не перекомпилируется,
+    // состояние машины (глобальные слоты, куча) сохраняется между вводами
+    void begin_session() {
+        code.clear();
+        closures.clear();
+        var_map.clear();
+        params.clear();
+        reset_segment();
+        entry = code_base;
+        start();
+        for (size_t i = 0; i + 1 < entry_count(); ++i) run_entry(entry_point(i));
+        halted = true;
+    }
+
+    // Новое имя видно в собственном определении (рекурсия), но остаётся
+    // в сеансе, только если определение скомпилировалось и вычислилось
+    void define(const std::string& name, const std::string& source) {
+        int slot = static_cast<int>(globals.size());
+        auto it = session_globals.find(name);
+        bool is_new = it == session_globals.end();
+        if (is_new) {
+            globals.push_back(make_value(ValueTag::ATOM, 0));
+            session_globals[name] = slot;
+        } else {
+            slot = it->second;
+        }
+
+        try {
+            run_entry(compile_input(source, {}, {{CAMCommand::SET_GLOBAL, slot}}));
+        } catch (...) {
+            if (is_new) {
+                session_globals.erase(name);
+                globals.pop_back();
+            }
+            throw;
+        }
+    }
+
+    std::string eval(const std::string& source) {
+        stack.clear();
+        run_entry(compile_input(source, {}, {}));
+        std::string result = get_result();
+        stack.clear();
+        return result;
+    }
+
+    void run() {
+        start();
+        resume(SIZE_MAX);
+    }
+
+    // Сбрасывает состояние и встаёт на первую точку входа
+    void start(const std::vector<std::string>& inputs = {}) {
+        if (inputs.size() != params.size()) {
+            throw std::runtime_error("Expected " + std::to_string(params.size()) + " inputs");
+        }
+        this->inputs = inputs;
+        env.clear();
+        stack.clear();
+        return_stack.clear();
+        heap.clear();
+        thunks.clear();
+        collect_at = MIN_COLLECT;
+        globals.assign(prelude ? prelude->slots() : 0, make_value(ValueTag::ATOM, 0));
+
+        steps = 0;
+        halted = false;
+        enter(0);
+    }
+
+    // Выполняет не более max_steps команд; возвращает true, если программа завершилась
+    bool resume(size_t max_steps) {
+        if (!halted) execute(max_steps);
+        return halted;
+    }
+
+    bool finished() const { return halted; }
+    size_t step_count() const { return steps; }
+
+    // Удаляет из кучи и таблицы thunk'ов записи, недостижимые из стека, окружений
+    // и глобальных слотов; живые записи получают новые номера по порядку
+    void collect();
+    size_t heap_size() const { return heap.size() + thunks.size(); }
+
+    // Снимок состояния исполнения в плоском двоичном формате (см. Snapshot);
+    // пишутся только достижимые замыкания и thunk'и
+    std::vector<char> checkpoint() const;
+    // Восстанавливает снимок в машину с той же загруженной программой
+    void restore(const char* data, size_t size);
+
+    std::string get_result() const {
+        if (stack.empty()) return "No result";
+        return value_to_string(stack.back());
+    }
+
+    void print_code() const {
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            switch (code[pc]) {
+                case CAMCommand::ACCESS: std::cout << "ACCESS " << operand(code[++pc]) << " "; break;
+                case CAMCommand::APPLY: std::cout << "APPLY "; break;
+                case CAMCommand::GRAB: std::cout << "GRAB "; break;
+                case CAMCommand::RETURN: std::cout << "RETURN "; break;
+                case CAMCommand::PUSH_CLOSURE: std::cout << "PUSH_CLOSURE " << operand(code[++pc]) << " "; break;
+                case CAMCommand::DELAY: std::cout << "DELAY " << operand(code[++pc]) << " "; break;
+                case CAMCommand::FORCE: std::cout << "FORCE "; break;
+                case CAMCommand::CONST: std::cout << "CONST " << operand(code[++pc]) << " "; break;
+                case CAMCommand::GLOBAL: std::cout << "GLOBAL " << operand(code[++pc]) << " "; break;
+                case CAMCommand::SET_GLOBAL: std::cout << "SET_GLOBAL " << operand(code[++pc]) << " "; break;
+                case CAMCommand::BIND: std::cout << "BIND "; break;
+                case CAMCommand::UNBIND: std::cout << "UNBIND "; break;
+                case CAMCommand::DUMMY: std::cout << "DUMMY "; break;
+                case CAMCommand::FIX: std::cout << "FIX "; break;
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    size_t code_size() const { return code.size(); }
+
+private:
+    static int operand(CAMCommand cmd) { return static_cast<int>(cmd); }
+
+    CAMCommand fetch(size_t pc) const {
+        return pc < code_base ? prelude->segment.code[pc] : code[pc - code_base];
+    }
+
+    const Closure& closure_at(int index) const {
+        size_t idx = static_cast<size_t>(index);
+        return idx < closure_base ? prelude->segment.closures[idx] : closures[idx - closure_base];
+    }
+
+    size_t entry_count() const { return (prelude ? prelude->entries.size() : 0) + 1; }
+
+    size_t entry_point(size_t i) const {
+        return prelude && i < prelude->entries.size() ? prelude->entries[i] : entry;
+    }
+
+    // Переход к точке входа; перед программой окружение заполняется входами
+    void enter(size_t i) {
+        current_entry = i;
+        pc = entry_point(i);
+        if (i + 1 == entry_count()) {
+            env.clear();
+            for (const auto& name : inputs) env.push_back(resolve_input(name));
+        }
+    }
+
+    // Вход — определение прелюдии (уже вычисленное) или атом
+    int resolve_input(const std::string& name) {
+        if (prelude) {
+            if (auto g = prelude->globals.find(name); g != prelude->globals.end()) {
+                return globals[g->second];
+            }
+        }
+        auto [it, inserted] = var_map.emplace(name, static_cast<int>(var_map.size()) + 1);
+        return make_value(ValueTag::ATOM, it->second);
+    }
+
+    void reset_segment() {
+        code_base = prelude ? prelude->segment.code.size() : 0;
+        closure_base = prelude ? prelude->segment.closures.size() : 0;
+        session_globals = prelude ? prelude->globals : std::map<std::string, int>{};
+    }
+
+    // Компилирует ввод в конец собственного сегмента; возвращает точку входа
+    size_t compile_input(const std::string& source, const std::vector<std::string>& params,
+                         const std::vector<std::pair<CAMCommand, int>>& tail) {
+        Parser parser(source);
+        auto ast = parser.parse_program();
+
+        DeBruijnConverter converter;
+        converter.bind_params(params);
+        auto db_ast = converter.convert(ast);
+
+        // Свободные переменные: сначала глобальные определения, остальные — атомы
+        for (const auto& var : converter.get_free_vars()) {
+            if (session_globals.find(var) == session_globals.end()) {
+                var_map.emplace(var, static_cast<int>(var_map.size()) + 1);
+            }
+        }
+
+        // Сегмент сеанса на время компиляции переезжает в компилятор; при ошибке
+        // он возвращается без недописанного хвоста — на прежний код ссылаются глобальные слоты
+        size_t code_size = code.size();
+        size_t closure_count = closures.size();
+        CodeSegment segment{std::move(code), std::move(closures)};
+        size_t input_entry = 0;
+        try {
+            Compiler compiler(segment, code_base, closure_base, session_globals, var_map, is_lazy);
+            input_entry = compiler.compile_entry(db_ast, tail);
+        } catch (...) {
+            segment.code.erase(segment.code.begin() + code_size, segment.code.end());
+            segment.closures.erase(segment.closures.begin() + closure_count, segment.closures.end());
+            code = std::move(segment.code);
+            closures = std::move(segment.closures);
+            throw;
+        }
+        code = std::move(segment.code);
+        closures = std::move(segment.closures);
+        return input_entry;
+    }
+
+    // Исполняет код с адреса до RETURN верхнего уровня, не сбрасывая состояние
+    void run_entry(size_t at) {
+        // После ошибки в прошлом вводе на стеках могли остаться кадры
+        return_stack.clear();
+        env.clear();
+        current_entry = entry_count() - 1;
+        pc = at;
+        halted = false;
+        execute(SIZE_MAX);
+    }
+
+    // Хэш кода программы и прелюдии: снимок применим только к тому же коду
+    uint64_t code_hash() const {
+        uint64_t hash = 1469598103934665603ull;
+        auto mix = [&](const std::vector<CAMCommand>& segment) {
+            for (auto cmd : segment) {
+                hash ^= static_cast<uint64_t>(cmd);
+                hash *= 1099511628211ull;
+            }
+        };
+        if (prelude) mix(prelude->segment.code);
+        mix(code);
+        return hash ^ entry;
+    }
+
+    // Верхние слоты окружения, которые читает тело блока: ACCESS считает с конца,
+    // поэтому отброшенное начало окружения телу не видно
+    std::vector<int> capture(const Closure& block) const {
+        size_t depth = std::min(block.captured_depth, env.size());
+        return std::vector<int>(env.end() - depth, env.end());
+    }
+
+    int pop() {
+        if (stack.empty()) throw std::runtime_error("Stack underflow");
+        int value = stack.back();
+        stack.pop_back();
+        return value;
+    }
+
+    // Живые записи кучи и таблицы thunk'ов: новый номер или -1 для мусора
+    struct LiveMap {
+        std::vector<int> closures;
+        std::vector<int> thunks;
+        size_t closure_count = 0;
+        size_t thunk_count = 0;
+
+        int remap(int value) const {
+            switch (value_tag(value)) {
+                case ValueTag::CLOSURE: return make_value(ValueTag::CLOSURE, closures[value_payload(value)]);
+                case ValueTag::THUNK: return make_value(ValueTag::THUNK, thunks[value_payload(value)]);
+                default: return value;
+            }
+        }
+        std::vector<int> remap(const std::vector<int>& values) const {
+            std::vector<int> out(values.size());
+            std::transform(values.begin(), values.end(), out.begin(), [&](int v) { return remap(v); });
+            return out;
+        }
+    };
+
+    // Пометка без рекурсии: явный стек достигнутых значений
+    LiveMap mark_live() const {
+        LiveMap live{std::vector<int>(heap.size(), -1), std::vector<int>(thunks.size(), -1)};
+        std::vector<int> pending;
+        auto visit = [&](int value) {
+            auto tag = value_tag(value);
+            if (tag == ValueTag::ATOM) return;
+            auto& mark = tag == ValueTag::CLOSURE ? live.closures[value_payload(value)]
+                                                  : live.thunks[value_payload(value)];
+            if (mark < 0) {
+                mark = 0;
+                pending.push_back(value);
+            }
+        };
+        auto visit_all = [&](const std::vector<int>& values) {
+            for (int value : values) visit(value);
+        };
+
+        visit_all(stack);
+        visit_all(env);
+        visit_all(globals);
+        for (const auto& frame : return_stack) {
+            visit_all(frame.env);
+            if (frame.update_thunk >= 0) visit(make_value(ValueTag::THUNK, frame.update_thunk));
+        }
+        while (!pending.empty()) {
+            int value = pending.back();
+            pending.pop_back();
+            if (value_tag(value) == ValueTag::CLOSURE) {
+                visit_all(heap[value_payload(value)].captured_env);
+            } else {
+                const auto& thunk = thunks[value_payload(value)];
+                visit_all(thunk.saved_env);
+                if (thunk.evaluated) visit(thunk.value);
+            }
+        }
+
+        for (auto& mark : live.closures) if (mark == 0) mark = static_cast<int>(live.closure_count++);
+        for (auto& mark : live.thunks) if (mark == 0) mark = static_cast<int>(live.thunk_count++);
+        return live;
+    }
+
+    // Исполняет не более budget команд с текущего pc.
+    // Между командами все значения лежат в стеке, окружениях и слотах — там же и сборка
+    void execute(size_t budget) {
+        for (; budget > 0; --budget) {
+            if (heap.size() + thunks.size() >= collect_at) collect();
+            ++steps;
+            auto cmd = fetch(pc++);
+            switch (cmd) {
+                case CAMCommand::ACCESS: {
+                    size_t idx = operand(fetch(pc++));
+                    if (idx >= env.size()) throw std::runtime_error("Invalid environment index");
+                    stack.push_back(env[env.size() - idx - 1]);
+                    break;
+                }
+                case CAMCommand::CONST:
+                    stack.push_back(make_value(ValueTag::ATOM, operand(fetch(pc++))));
+                    break;
+                case CAMCommand::GLOBAL:
+                    stack.push_back(globals[operand(fetch(pc++))]);
+                    break;
+                case CAMCommand::SET_GLOBAL:
+                    globals[operand(fetch(pc++))] = pop();
+                    break;
+                case CAMCommand::PUSH_CLOSURE: {
+                    int idx = operand(fetch(pc++));
+                    const Closure& block = closure_at(idx);
+                    heap.push_back({capture(block), block.body_pos, idx, {}});
+                    stack.push_back(make_value(ValueTag::CLOSURE, static_cast<int>(heap.size() - 1)));
+                    break;
+                }
+                case CAMCommand::APPLY: {
+                    int fun = pop();
+                    if (value_tag(fun) != ValueTag::CLOSURE) {
+                        throw std::runtime_error("Cannot apply non-function: " + value_to_string(fun));
+                    }
+                    // Аргумент остаётся на стеке и снимается GRAB в начале тела.
+                    // Перед RETURN кадр не нужен: тело вернётся прямо в кадр вызывающего
+                    const auto& cl = heap[value_payload(fun)];
+                    if (fetch(pc) != CAMCommand::RETURN) return_stack.push_back({pc, std::move(env), -1});
+                    env = cl.captured_env;
+                    pc = cl.body_pos;
+                    break;
+                }
+                case CAMCommand::GRAB:
+                case CAMCommand::BIND:
+                    env.push_back(pop());
+                    break;
+                case CAMCommand::UNBIND:
+                    env.pop_back();
+                    break;
+                case CAMCommand::DUMMY:
+                    env.push_back(make_value(ValueTag::ATOM, 0));
+                    break;
+                case CAMCommand::FIX: {
+                    int value = pop();
+                    env.back() = value;
+                    // Замыкание захватило зарезервированный слот последним — замыкаем его на себя
+                    if (value_tag(value) == ValueTag::CLOSURE) {
+                        auto& captured = heap[value_payload(value)].captured_env;
+                        if (!captured.empty()) captured.back() = value;
+                    }
+                    break;
+                }
+                case CAMCommand::RETURN: {
+                    if (return_stack.empty()) {
+                        // Конец точки входа: следующее определение прелюдии или останов
+                        if (++current_entry == entry_count()) {
+                            halted = true;
+                            return;
+                        }
+                        enter(current_entry);
+                        break;
+                    }
+                    Frame& frame = return_stack.back();
+                    pc = frame.pc;
+                    env = std::move(frame.env);
+                    if (frame.update_thunk >= 0) {
+                        auto& thunk = thunks[frame.update_thunk];
+                        thunk.value = stack.back();
+                        thunk.evaluated = true;
+                    }
+                    return_stack.pop_back();
+                    break;
+                }
+                case CAMCommand::DELAY: {
+                    // Сохраняем текущее окружение и позицию тела thunk'а
+                    int idx = operand(fetch(pc++));
+                    thunks.push_back({
+                        capture(closure_at(idx)),   // Читаемая телом часть окружения
+                        closure_at(idx).body_pos,   // Позиция начала тела thunk'а
+                        false,                      // Флаг "не вычислено"
+                        0                           // Пустое значение
+                    });
+                    stack.push_back(make_value(ValueTag::THUNK, static_cast<int>(thunks.size() - 1)));
+                    break;
+                }
+                case CAMCommand::FORCE: {
+                    if (stack.empty()) throw std::runtime_error("Stack underflow");
+                    int value = stack.back();
+                    if (value_tag(value) != ValueTag::THUNK) break;
+                    int thunk_idx = value_payload(value);
+                    auto& thunk = thunks[thunk_idx];
+                    stack.pop_back();
+                    if (thunk.evaluated) {
+                        // Уже вычислен — берем значение
+                        stack.push_back(thunk.value);
+                    } else {
+                        // Вычисляем thunk, результат запоминается при RETURN
+                        return_stack.push_back({pc, std::move(env), thunk_idx});
+                        env = thunk.saved_env;
+                        pc = thunk.body_pos;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    std::string value_to_string(int value) const {
+        switch (value_tag(value)) {
+            case ValueTag::ATOM:
+                for (const auto& [name, id] : var_map) {
+                    if (id == value_payload(value)) return name;
+                }
+                return "<unbound>";
+            case ValueTag::CLOSURE:
+                return closure_at(heap[value_payload(value)].index).repr();
+            case ValueTag::THUNK: {
+                const auto& thunk = thunks[value_payload(value)];
+                return thunk.evaluated ? value_to_string(thunk.value) : "<thunk>";
+            }
+        }
+        return std::to_string(value);
+    }
+};
+
+inline void CAMMachine::collect() {
+    LiveMap live = mark_live();
+
+    std::vector<Closure> live_heap;
+    live_heap.reserve(live.closure_count);
+    for (size_t i = 0; i < heap.size(); ++i) {
+        if (live.closures[i] < 0) continue;
+        live_heap.push_back(std::move(heap[i]));
+        live_heap.back().captured_env = live.remap(live_heap.back().captured_env);
+    }
+    std::vector<Thunk> live_thunks;
+    live_thunks.reserve(live.thunk_count);
+    for (size_t i = 0; i < thunks.size(); ++i) {
+        if (live.thunks[i] < 0) continue;
+        live_thunks.push_back(std::move(thunks[i]));
+        Thunk& thunk = live_thunks.back();
+        thunk.saved_env = live.remap(thunk.saved_env);
+        if (thunk.evaluated) thunk.value = live.remap(thunk.value);
+    }
+
+    stack = live.remap(stack);
+    env = live.remap(env);
+    globals = live.remap(globals);
+    for (auto& frame : return_stack) {
+        frame.env = live.remap(frame.env);
+        if (frame.update_thunk >= 0) frame.update_thunk = live.thunks[frame.update_thunk];
+    }
+    heap = std::move(live_heap);
+    thunks = std::move(live_thunks);
+    collect_at = std::max(MIN_COLLECT, 2 * (heap.size() + thunks.size()));
+}
+
+inline std::vector<char> CAMMachine::checkpoint() const {
+    LiveMap live = mark_live();
+    std::vector<int32_t> pool;
+    auto add_env = [&](const std::vector<int>& values) {
+        Snapshot::EnvRef ref{pool.size(), values.size()};
+        for (int value : values) pool.push_back(live.remap(value));
+        return ref;
+    };
+
+    std::vector<Snapshot::FrameRecord> frames;
+    frames.reserve(return_stack.size());
+    for (const auto& frame : return_stack) {
+        int update_thunk = frame.update_thunk >= 0 ? live.thunks[frame.update_thunk] : -1;
+        frames.push_back({frame.pc, add_env(frame.env), update_thunk, 0});
+    }
+    std::vector<Snapshot::ClosureRecord> closure_records;
+    closure_records.reserve(live.closure_count);
+    for (size_t i = 0; i < heap.size(); ++i) {
+        if (live.closures[i] < 0) continue;
+        const auto& cl = heap[i];
+        closure_records.push_back({cl.body_pos, add_env(cl.captured_env), cl.index, 0});
+    }
+    std::vector<Snapshot::ThunkRecord> thunk_records;
+    thunk_records.reserve(live.thunk_count);
+    for (size_t i = 0; i < thunks.size(); ++i) {
+        if (live.thunks[i] < 0) continue;
+        const auto& thunk = thunks[i];
+        int value = thunk.evaluated ? live.remap(thunk.value) : thunk.value;
+        thunk_records.push_back({thunk.body_pos, add_env(thunk.saved_env), thunk.evaluated, value});
+    }
+    std::vector<int> live_stack = live.remap(stack);
+    std::vector<int> live_env = live.remap(env);
+    std::vector<int> live_globals = live.remap(globals);
+
+    std::vector<char> names;
+    auto add_name = [&](const std::string& name) {
+        Snapshot::NameRef ref{names.size(), name.size()};
+        names.insert(names.end(), name.begin(), name.end());
+        return ref;
+    };
+    std::vector<Snapshot::NameRef> input_records;
+    input_records.reserve(inputs.size());
+    for (const auto& name : inputs) input_records.push_back(add_name(name));
+    std::vector<Snapshot::AtomRecord> atom_records;
+    atom_records.reserve(var_map.size());
+    for (const auto& [name, id] : var_map) atom_records.push_back({add_name(name), id, 0});
+
+    Snapshot::Header header{};
+    header.magic = Snapshot::MAGIC;
+    header.version = Snapshot::VERSION;
+    header.code_hash = code_hash();
+    header.pc = pc;
+    header.current_entry = current_entry;
+    header.steps = steps;
+    header.halted = halted;
+
+    std::vector<char> out(sizeof(Snapshot::Header));
+    auto put = [&](Snapshot::SectionId id, const void* data, size_t count, size_t elem_size) {
+        size_t offset = (out.size() + 7) & ~size_t(7);
+        out.resize(offset + count * elem_size);
+        if (count) std::memcpy(out.data() + offset, data, count * elem_size);
+        header.sections[id] = {offset, count};
+    };
+    put(Snapshot::STACK, live_stack.data(), live_stack.size(), sizeof(int32_t));
+    put(Snapshot::ENV, live_env.data(), live_env.size(), sizeof(int32_t));
+    put(Snapshot::GLOBALS, live_globals.data(), live_globals.size(), sizeof(int32_t));
+    put(Snapshot::FRAMES, frames.data(), frames.size(), sizeof(Snapshot::FrameRecord));
+    put(Snapshot::CLOSURES, closure_records.data(), closure_records.size(), sizeof(Snapshot::ClosureRecord));
+    put(Snapshot::THUNKS, thunk_records.data(), thunk_records.size(), sizeof(Snapshot::ThunkRecord));
+    put(Snapshot::ENV_POOL, pool.data(), pool.size(), sizeof(int32_t));
+    put(Snapshot::INPUTS, input_records.data(), input_records.size(), sizeof(Snapshot::NameRef));
+    put(Snapshot::ATOMS, atom_records.data(), atom_records.size(), sizeof(Snapshot::AtomRecord));
+    put(Snapshot::NAMES, names.data(), names.size(), sizeof(char));
+    std::memcpy(out.data(), &header, sizeof header);
+    return out;
+}
+
+inline void CAMMachine::restore(const char* data, size_t size) {
+    Snapshot::Header header;
+    if (size < sizeof header) throw std::runtime_error("Snapshot is truncated");
+    std::memcpy(&header, data, sizeof header);
+    if (header.magic != Snapshot::MAGIC || header.version != Snapshot::VERSION) {
+        throw std::runtime_error("Not a CAM snapshot");
+    }
+    if (header.code_hash != code_hash()) {
+        throw std::runtime_error("Snapshot does not match loaded program");
+    }
+
+    auto read = [&](Snapshot::SectionId id, auto& out) {
+        using T = typename std::decay_t<decltype(out)>::value_type;
+        const auto& section = header.sections[id];
+        if (section.offset > size || section.count > (size - section.offset) / sizeof(T)) {
+            throw std::runtime_error("Snapshot section out of bounds");
+        }
+        out.resize(section.count);
+        if (section.count) std::memcpy(out.data(), data + section.offset, section.count * sizeof(T));
+    };
+
+    // Всё читается во временные векторы и проверяется до изменения машины:
+    // при ошибке в снимке её состояние остаётся прежним
+    std::vector<int> new_stack, new_env, new_globals;
+    std::vector<int32_t> pool;
+    std::vector<Snapshot::FrameRecord> frames;
+    std::vector<Snapshot::ClosureRecord> closure_records;
+    std::vector<Snapshot::ThunkRecord> thunk_records;
+    std::vector<Snapshot::NameRef> input_records;
+    std::vector<Snapshot::AtomRecord> atom_records;
+    std::vector<char> names;
+    read(Snapshot::STACK, new_stack);
+    read(Snapshot::ENV, new_env);
+    read(Snapshot::GLOBALS, new_globals);
+    read(Snapshot::FRAMES, frames);
+    read(Snapshot::CLOSURES, closure_records);
+    read(Snapshot::THUNKS, thunk_records);
+    read(Snapshot::ENV_POOL, pool);
+    read(Snapshot::INPUTS, input_records);
+    read(Snapshot::ATOMS, atom_records);
+    read(Snapshot::NAMES, names);
+
+    const size_t code_size = code_base + code.size();
+    const size_t closure_count = closure_base + closures.size();
+    auto check = [](bool ok, const char* what) {
+        if (!ok) throw std::runtime_error(std::string("Snapshot is corrupt: ") + what);
+    };
+    auto check_value = [&](int value) {
+        int payload = value_payload(value);
+        switch (value_tag(value)) {
+            case ValueTag::ATOM: return;
+            case ValueTag::CLOSURE:
+                check(payload >= 0 && static_cast<size_t>(payload) < closure_records.size(), "closure index");
+                return;
+            case ValueTag::THUNK:
+                check(payload >= 0 && static_cast<size_t>(payload) < thunk_records.size(), "thunk index");
+                return;
+        }
+        check(false, "value tag");
+    };
+    auto check_values = [&](const auto& values) {
+        for (int value : values) check_value(value);
+    };
+    auto get_env = [&](const Snapshot::EnvRef& ref) {
+        check(ref.offset <= pool.size() && ref.size <= pool.size() - ref.offset, "environment bounds");
+        return std::vector<int>(pool.begin() + ref.offset, pool.begin() + ref.offset + ref.size);
+    };
+    auto get_name = [&](const Snapshot::NameRef& ref) {
+        check(ref.offset <= names.size() && ref.size <= names.size() - ref.offset, "name bounds");
+        return std::string(names.begin() + ref.offset, names.begin() + ref.offset + ref.size);
+    };
+
+    check(header.pc <= code_size, "pc");
+    // После завершения последней точки входа current_entry == entry_count()
+    check(header.current_entry < entry_count() ||
+          (header.halted && header.current_entry == entry_count()), "entry");
+    check(new_globals.size() >= (prelude ? prelude->slots() : 0), "globals");
+    check(input_records.size() == params.size(), "inputs");
+    check_values(new_stack);
+    check_values(new_env);
+    check_values(new_globals);
+    check_values(pool);
+
+    std::vector<Frame> new_return_stack;
+    new_return_stack.reserve(frames.size());
+    for (const auto& frame : frames) {
+        check(frame.pc <= code_size, "frame pc");
+        check(frame.update_thunk == -1 ||
+              (frame.update_thunk >= 0 && static_cast<size_t>(frame.update_thunk) < thunk_records.size()),
+              "update thunk");
+        new_return_stack.push_back({frame.pc, get_env(frame.env), frame.update_thunk});
+    }
+    std::vector<Closure> new_heap;
+    new_heap.reserve(closure_records.size());
+    for (const auto& cl : closure_records) {
+        check(cl.body_pos < code_size, "closure body");
+        check(cl.index >= 0 && static_cast<size_t>(cl.index) < closure_count, "closure template");
+        new_heap.push_back({get_env(cl.env), cl.body_pos, cl.index, nullptr});
+    }
+    std::vector<Thunk> new_thunks;
+    new_thunks.reserve(thunk_records.size());
+    for (const auto& thunk : thunk_records) {
+        check(thunk.body_pos < code_size, "thunk body");
+        if (thunk.evaluated) check_value(thunk.value);
+        new_thunks.push_back({get_env(thunk.env), thunk.body_pos, thunk.evaluated != 0, thunk.value});
+    }
+    std::vector<std::string> new_inputs;
+    new_inputs.reserve(input_records.size());
+    for (const auto& ref : input_records) new_inputs.push_back(get_name(ref));
+    // Совпадение хэша кода гарантирует те же атомы компиляции, поэтому таблица
+    // снимка (с атомами входов) заменяет текущую целиком
+    std::map<std::string, int> new_var_map;
+    for (const auto& atom : atom_records) {
+        check(atom.id > 0 && atom.id <= MAX_VALUE_PAYLOAD, "atom id");
+        check(new_var_map.emplace(get_name(atom.name), atom.id).second, "duplicate atom");
+    }
+
+    stack = std::move(new_stack);
+    env = std::move(new_env);
+    globals = std::move(new_globals);
+    return_stack = std::move(new_return_stack);
+    heap = std::move(new_heap);
+    thunks = std::move(new_thunks);
+    inputs = std::move(new_inputs);
+    var_map = std::move(new_var_map);
+    pc = header.pc;
+    current_entry = header.current_entry;
+    steps = header.steps;
+    halted = header.halted != 0;
+}
+
+// Пакетное исполнение одной программы над многими входами в стиле SIMT.
+// Дорожки идут в ногу по общему pc; стек, окружения, глобальные слоты и куча
+// хранятся как структура массивов: элемент (уровень, дорожка) лежит по индексу
+// уровень * lanes + дорожка, так что команда выполняется одним циклом по дорожкам.
+// Дорожка, у которой APPLY уходит в другое тело, переносится в скалярную
+// CAMMachine и досчитывается отдельно.
+class BatchMachine {
+    struct Frame {
+        size_t pc;
+        size_t env_depth;
+        std::vector<int> env;
+    };
+
+    struct BatchClosure {
+        size_t body_pos;
+        int index;
+        size_t env_depth;
+        std::vector<int> env;
+    };
+
+    CAMMachine program;     // скомпилированный код и шаблоны замыканий
+    size_t lanes = 0;
+    std::vector<uint8_t> active;
+
+    std::vector<int> stack;
+    size_t stack_depth = 0;
+    std::vector<int> env;
+    size_t env_depth = 0;
+    std::vector<int> globals;
+    std::vector<Frame> frames;
+    std::vector<BatchClosure> heap;
+
+    size_t pc = 0;
+    size_t current_entry = 0;
+    size_t steps = 0;           // команды, выполненные в ногу
+    size_t scalar_steps = 0;    // команды разошедшихся дорожек
+    std::vector<std::string> results;
+
+    int* row(std::vector<int>& soa, size_t level) { return soa.data() + level * lanes; }
+
+    int* push_row() {
+        if ((stack_depth + 1) * lanes > stack.size()) stack.resize((stack_depth + 1) * lanes * 2);
+        return row(stack, stack_depth++);
+    }
+
+    const int* pop_row() {
+        if (stack_depth == 0) throw std::runtime_error("Stack underflow");
+        return row(stack, --stack_depth);
+    }
+
+    void push_env_row(const int* values) {
+        env.resize((env_depth + 1) * lanes);
+        std::copy(values, values + lanes, row(env, env_depth++));
+    }
+
+    size_t leader() const {
+        auto it = std::find(active.begin(), active.end(), 1);
+        return static_cast<size_t>(it - active.begin());
+    }
+
+    void enter(size_t i, const std::vector<std::vector<std::string>>& inputs) {
+        current_entry = i;
+        pc = program.entry_point(i);
+        if (i + 1 != program.entry_count()) return;
+        env.assign(program.params.size() * lanes, 0);
+        env_depth = program.params.size();
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            for (size_t p = 0; p < program.params.size(); ++p) {
+                env[p * lanes + lane] = resolve_input(inputs[lane][p], lane);
+            }
+        }
+    }
+
+    int resolve_input(const std::string& name, size_t lane) {
+        if (program.prelude) {
+            if (auto g = program.prelude->globals.find(name); g != program.prelude->globals.end()) {
+                return globals[g->second * lanes + lane];
+            }
+        }
+        auto [it, inserted] = program.var_map.emplace(name, static_cast<int>(program.var_map.size()) + 1);
+        return make_value(ValueTag::ATOM, it->second);
+    }
+
+    // Переносит состояние дорожки в скалярную машину и досчитывает её;
+    // pc указывает на команду, которую дорожка выполнит первой
+    void diverge(size_t lane, size_t lane_pc) {
+        CAMMachine scalar = program;
+        scalar.halted = false;
+        scalar.steps = 0;
+        scalar.pc = lane_pc;
+        scalar.current_entry = current_entry;
+
+        auto column = [&](const std::vector<int>& soa, size_t depth) {
+            std::vector<int> out(depth);
+            for (size_t level = 0; level < depth; ++level) out[level] = soa[level * lanes + lane];
+            return out;
+        };
+        scalar.stack = column(stack, stack_depth);
+        scalar.env = column(env, env_depth);
+        scalar.globals = column(globals, globals.size() / lanes);
+        scalar.return_stack.clear();
+        for (const auto& frame : frames) {
+            scalar.return_stack.push_back({frame.pc, column(frame.env, frame.env_depth), -1});
+        }
+        scalar.heap.clear();
+        for (const auto& cl : heap) {
+            scalar.heap.push_back({column(cl.env, cl.env_depth), cl.body_pos, cl.index, nullptr});
+        }
+
+        try {
+            scalar.resume(SIZE_MAX);
+            results[lane] = scalar.get_result();
+        } catch (const std::exception& e) {
+            results[lane] = std::string("Error: ") + e.what();
+        }
+        scalar_steps += scalar.step_count();
+        active[lane] = 0;
+    }
+
+    std::string lane_result(size_t lane) const {
+        if (stack_depth == 0) return "No result";
+        int value = stack[(stack_depth - 1) * lanes + lane];
+        if (value_tag(value) == ValueTag::CLOSURE) {
+            return program.closure_at(heap[value_payload(value)].index).repr();
+        }
+        return program.value_to_string(value);
+    }
+
+    void execute(const std::vector<std::vector<std::string>>& inputs) {
+        while (leader() < lanes) {
+            ++steps;
+            auto cmd = program.fetch(pc++);
+            switch (cmd) {
+                case CAMCommand::ACCESS: {
+                    size_t idx = static_cast<size_t>(program.fetch(pc++));
+                    if (idx >= env_depth) throw std::runtime_error("Invalid environment index");
+                    const int* src = row(env, env_depth - idx - 1);
+                    int* dst = push_row();
+                    std::copy(src, src + lanes, dst);
+                    break;
+                }
+                case CAMCommand::CONST: {
+                    int value = make_value(ValueTag::ATOM, static_cast<int>(program.fetch(pc++)));
+                    std::fill_n(push_row(), lanes, value);
+                    break;
+                }
+                case CAMCommand::GLOBAL: {
+                    const int* src = row(globals, static_cast<size_t>(program.fetch(pc++)));
+                    int* dst = push_row();
+                    std::copy(src, src + lanes, dst);
+                    break;
+                }
+                case CAMCommand::SET_GLOBAL: {
+                    int* dst = row(globals, static_cast<size_t>(program.fetch(pc++)));
+                    const int* src = pop_row();
+                    std::copy(src, src + lanes, dst);
+                    break;
+                }
+                case CAMCommand::PUSH_CLOSURE: {
+                    // Замыкание создаётся одной командой на всех дорожках — индекс общий
+                    int idx = static_cast<int>(program.fetch(pc++));
+                    heap.push_back({program.closure_at(idx).body_pos, idx, env_depth,
+                                    std::vector<int>(env.begin(), env.begin() + env_depth * lanes)});
+                    std::fill_n(push_row(), lanes, make_value(ValueTag::CLOSURE, static_cast<int>(heap.size() - 1)));
+                    break;
+                }
+                case CAMCommand::APPLY: {
+                    const int* funs = row(stack, stack_depth - 1);
+                    size_t lead = leader();
+                    int lead_fun = funs[lead];
+                    if (value_tag(lead_fun) != ValueTag::CLOSURE) {
+                        diverge(lead, pc - 1);
+                        --pc;
+                        break;
+                    }
+                    size_t body = heap[value_payload(lead_fun)].body_pos;
+                    bool uniform = true;
+                    for (size_t lane = lead + 1; lane < lanes; ++lane) {
+                        if (!active[lane] || funs[lane] == lead_fun) continue;
+                        uniform = false;
+                        if (value_tag(funs[lane]) != ValueTag::CLOSURE ||
+                            heap[value_payload(funs[lane])].body_pos != body) {
+                            diverge(lane, pc - 1);
+                        }
+                    }
+
+                    --stack_depth;
+                    frames.push_back({pc, env_depth, std::move(env)});
+                    const auto& lead_cl = heap[value_payload(lead_fun)];
+                    env_depth = lead_cl.env_depth;
+                    if (uniform) {
+                        env = lead_cl.env;
+                    } else {
+                        // Разные замыкания одного тела: собираем окружение по дорожкам
+                        env.resize(env_depth * lanes);
+                        for (size_t lane = 0; lane < lanes; ++lane) {
+                            int fun = active[lane] ? funs[lane] : lead_fun;
+                            const auto& src = heap[value_payload(fun)].env;
+                            for (size_t level = 0; level < env_depth; ++level) {
+                                env[level * lanes + lane] = src[level * lanes + lane];
+                            }
+                        }
+                    }
+                    pc = body;
+                    break;
+                }
+                case CAMCommand::GRAB:
+                case CAMCommand::BIND:
+                    push_env_row(pop_row());
+                    break;
+                case CAMCommand::UNBIND:
+                    --env_depth;
+                    break;
+                case CAMCommand::DUMMY: {
+                    std::vector<int> dummy(lanes, make_value(ValueTag::ATOM, 0));
+                    push_env_row(dummy.data());
+                    break;
+                }
+                case CAMCommand::FIX: {
+                    const int* values = pop_row();
+                    int* slot = row(env, env_depth - 1);
+                    for (size_t lane = 0; lane < lanes; ++lane) {
+                        slot[lane] = values[lane];
+                        if (!active[lane] || value_tag(values[lane]) != ValueTag::CLOSURE) continue;
+                        auto& cl = heap[value_payload(values[lane])];
+                        if (cl.env_depth > 0) cl.env[(cl.env_depth - 1) * lanes + lane] = values[lane];
+                    }
+                    break;
+                }
+                case CAMCommand::RETURN: {
+                    if (frames.empty()) {
+                        if (current_entry + 1 == program.entry_count()) {
+                            for (size_t lane = 0; lane < lanes; ++lane) {
+                                if (active[lane]) results[lane] = lane_result(lane);
+                            }
+                            return;
+                        }
+                        enter(current_entry + 1, inputs);
+                        break;
+                    }
+                    Frame& frame = frames.back();
+                    pc = frame.pc;
+                    env_depth = frame.env_depth;
+                    env = std::move(frame.env);
+                    frames.pop_back();
+                    break;
+                }
+                case CAMCommand::DELAY:
+                case CAMCommand::FORCE:
+                    throw std::runtime_error("Batch mode supports strict evaluation only");
+            }
+        }
+    }
+
+public:
+    explicit BatchMachine(std::shared_ptr<const Prelude> prelude = nullptr) : program(std::move(prelude)) {}
+
+    void load(const std::string& source, const std::vector<std::string>& params) {
+        program.load(source, params);
+    }
+
+    // inputs[lane] — значения параметров дорожки; возвращает результаты по дорожкам
+    std::vector<std::string> run(const std::vector<std::vector<std::string>>& inputs) {
+        lanes = inputs.size();
+        for (const auto& lane : inputs) {
+            if (lane.size() != program.params.size()) {
+                throw std::runtime_error("Expected " + std::to_string(program.params.size()) + " inputs per lane");
+            }
+        }
+        active.assign(lanes, 1);
+        results.assign(lanes, "No result");
+        stack.assign(16 * lanes, 0);
+        stack_depth = 0;
+        env.clear();
+        env_depth = 0;
+        globals.assign((program.prelude ? program.prelude->slots() : 0) * lanes, make_value(ValueTag::ATOM, 0));
+        frames.clear();
+        heap.clear();
+        steps = 0;
+        scalar_steps = 0;
+
+        if (lanes == 0) return results;
+        enter(0, inputs);
+        execute(inputs);
+        return results;
+    }
+
+    size_t lockstep_steps() const { return steps; }
+    size_t diverged_steps() const { return scalar_steps; }
+    size_t diverged_lanes() const { return static_cast<size_t>(std::count(active.begin(), active.end(), 0)); }
+};
+
+} // namespace cam_new
+
+#endif
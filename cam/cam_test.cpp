@@ -1,5 +1,7 @@
 #include "cam.hpp"
 #include <iostream>
+#include <chrono>
+#include <unordered_set>
 
 void run_tests() {
     TypeVarGenerator::reset();
@@ -115,11 +117,363 @@ void run_tests() {
     } catch (const std::exception& e) {
         std::cout << "Ошибка типизации (ожидаемо): " << e.what() << "\n";
     }
+    
+    // Тест 6: Типы параметров выводятся унификацией
+    Type f_type = make_typevar();
+    Type x_type = make_typevar();
+    Expr apply_f = make_lambda("f", f_type, make_lambda("x", x_type,
+                               make_apply(make_variable("f", f_type), make_variable("x", x_type))));
+    Expr apply_f_not = make_apply(make_apply(apply_f, make_constant("not", arrow_bool_bool)), true_const);
+    
+    std::cout << "\nТест 6: Вывод типов параметров\n";
+    for (const Expr& expr : {apply_f, apply_f_not}) {
+        std::cout << "Выражение: ";
+        print_expr(expr);
+        std::cout << "\n";
+        try {
+            Type type = infer_type(expr, context);
+            std::cout << "Тип: " << type_to_string_full(type) << "\n";
+        } catch (const std::exception& e) {
+            std::cout << "Ошибка типизации: " << e.what() << "\n";
+        }
+    }
+    std::cout << "\n";
+    
+    // Тест 7: Равные типы — один узел
+    Type nested = make_arrow(make_arrow(make_typeconst("Bool"), make_typeconst("Bool")), bool_type);
+    std::cout << "Тест 7: Интернирование типов\n";
+    std::cout << "Bool: " << (make_typeconst("Bool") == bool_type ? "один узел" : "разные узлы") << "\n";
+    std::cout << type_to_string_full(nested) << ": "
+              << (nested == make_arrow(arrow_bool_bool, bool_type) ? "один узел" : "разные узлы") << "\n";
+    // Стрелка, построенная выводом (тип g в λg:?.g true), — тоже из таблицы
+    Type g_param = make_typevar();
+    Type apply_true = infer_type(make_lambda("g", g_param, make_apply(make_variable("g", g_param), true_const)), context);
+    auto inferred = std::get<std::shared_ptr<TypeArrow>>(apply_true);
+    std::cout << type_to_string_full(inferred->from) << " из вывода: "
+              << (inferred->from == make_arrow(bool_type, inferred->to) ? "один узел" : "разные узлы") << "\n\n";
+    
+    // Тест 8: Связывание в лямбде затеняет контекст только внутри тела
+    TypeContext outer;
+    outer["x"] = int_type;
+    Expr shadowing = make_lambda("x", bool_type, make_variable("x", bool_type));
+    Expr shadowing_error = make_lambda("x", bool_type, make_apply(make_variable("x", bool_type), zero));
+    std::cout << "Тест 8: Затенение в контексте\n";
+    std::cout << "Тип: " << type_to_string_full(infer_type(shadowing, outer)) << "\n";
+    try {
+        infer_type(shadowing_error, outer);
+    } catch (const std::exception&) {
+        std::cout << "Ошибка типизации (ожидаемо)\n";
+    }
+    std::cout << "x после вывода: " << type_to_string_full(outer["x"]) << ", записей " << outer.size() << "\n\n";
+    
+    // Тест 9: Один сеанс на несколько выводов; неудачный вывод откатывает свои связи
+    Type g_type = make_typevar();
+    Type y_type = make_typevar();
+    Expr apply_g = make_lambda("g", g_type, make_apply(make_variable("g", g_type), true_const));
+    Expr conflicting = make_lambda("g", g_type, make_apply(make_apply(make_constant("pair", make_arrow(bool_type, make_arrow(bool_type, bool_type))),
+                                   make_apply(make_variable("g", g_type), true_const)),
+                                   make_apply(make_variable("g", g_type), zero)));
+    Expr id_y = make_lambda("y", y_type, make_variable("y", y_type));
+    
+    std::cout << "Тест 9: Сеанс вывода\n";
+    TypeInference session(context);
+    try {
+        session.infer(conflicting);
+    } catch (const std::exception&) {
+        std::cout << "Ошибка типизации (ожидаемо), тип g после отката: " << type_to_string_full(g_type) << "\n";
+    }
+    std::cout << "Тип: " << type_to_string_full(session.infer(apply_g)) << "\n";
+    session.unify(y_type, bool_type);
+    std::cout << "Тип id после связывания в сеансе: " << type_to_string_full(session.infer(id_y)) << "\n";
+    
+    // infer_type не оставляет связей: тот же терм с разными применениями
+    Type id_type = make_typevar();
+    Expr id_x = make_lambda("x", id_type, make_variable("x", id_type));
+    std::cout << "infer_type id: " << type_to_string_full(infer_type(id_x, context));
+    std::cout << ", id true: " << type_to_string_full(infer_type(make_apply(id_x, true_const), context));
+    std::cout << ", снова id: " << type_to_string_full(infer_type(id_x, context));
+    std::cout << ", id 0: " << type_to_string_full(infer_type(make_apply(id_x, zero), context)) << "\n";
+    
+    // Старая переменная остаётся нетронутой и после сброса счётчика id
+    Type old_type = make_typevar();
+    TypeVarGenerator::reset();
+    infer_type(make_lambda("g", old_type, make_apply(make_variable("g", old_type), true_const)), context);
+    std::cout << "Переменная до reset() после infer_type: " << type_to_string_full(old_type) << "\n\n";
+}
+
+// Сбалансированное дерево из applications применений: внутренние узлы — k l r
+// с k : Bool -> Bool -> Bool, листья — (λx:?.x) (... true), где тип x выводится унификацией
+Expr balanced_applications(int applications, const Expr& k, const Expr& leaf_arg) {
+    if (applications < 4) {
+        Expr term = leaf_arg;
+        for (int i = 0; i < applications; ++i) {
+            Type t = make_typevar();
+            term = make_apply(make_lambda("x", t, make_variable("x", t)), term);
+        }
+        return term;
+    }
+    int rest = applications - 2;
+    return make_apply(make_apply(k, balanced_applications(rest / 2, k, leaf_arg)),
+                      balanced_applications(rest - rest / 2, k, leaf_arg));
+}
+
+int count_applications(const Expr& expr) {
+    if (auto a = std::get_if<std::shared_ptr<Apply>>(&expr)) {
+        return 1 + count_applications((*a)->func) + count_applications((*a)->arg);
+    }
+    if (auto l = std::get_if<std::shared_ptr<Lambda>>(&expr)) return count_applications((*l)->body);
+    return 0;
+}
+
+void bench_infer_applications() {
+    Type bool_type = make_typeconst("Bool");
+    Expr k = make_constant("k", make_arrow(bool_type, make_arrow(bool_type, bool_type)));
+    Expr true_const = make_constant("true", bool_type);
+    
+    for (int n : {1000, 10000, 100000}) {
+        Expr term = balanced_applications(n, k, true_const);
+        TypeContext context;
+        auto start = std::chrono::high_resolution_clock::now();
+        Type type = infer_type(term, context);
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Вывод типа: " << count_applications(term) << " применений, "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << " мс, тип "
+                  << type_to_string_full(type) << ", интернированных типов " << interned_types() << "\n";
+    }
+}
+
+// λx0:Bool.λx1:Bool. ... λx{n-1}:Bool. x0 — каждая лямбда расширяет контекст
+void bench_infer_nested_lambdas() {
+    Type bool_type = make_typeconst("Bool");
+    
+    for (int n : {1000, 2000, 4000}) {
+        Expr term = make_variable("x0", bool_type);
+        for (int i = n - 1; i >= 0; --i) term = make_lambda("x" + std::to_string(i), bool_type, term);
+        TypeContext context;
+        auto start = std::chrono::high_resolution_clock::now();
+        Type type = infer_type(term, context);
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Вывод типа: " << n << " вложенных лямбд, "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << " мс, контекст после вывода "
+                  << context.size() << "\n";
+    }
+}
+
+// Нумералы Чёрча и арифметика над ними в именованной форме
+Expr church_numeral(int n) {
+    Type t = make_typevar();
+    Expr body = make_variable("x", t);
+    for (int i = 0; i < n; ++i) body = make_apply(make_variable("f", t), body);
+    return make_lambda("f", t, make_lambda("x", t, body));
+}
+
+Expr var(const std::string& name) { return make_variable(name, make_typevar()); }
+Expr lam(const std::string& param, Expr body) { return make_lambda(param, make_typevar(), body); }
+Expr app(Expr func, Expr arg) { return make_apply(func, arg); }
+
+Expr church_plus() { return lam("m", lam("n", lam("f", lam("x", app(app(var("m"), var("f")), app(app(var("n"), var("f")), var("x"))))))); }
+Expr church_mult() { return lam("m", lam("n", lam("f", app(var("m"), app(var("n"), var("f")))))); }
+Expr church_exp() { return lam("m", lam("n", app(var("n"), var("m")))); }
+
+bool same_expr(const Expr& a, const Expr& b) {
+    if (a.index() != b.index()) return false;
+    if (auto c = std::get_if<std::shared_ptr<Constant>>(&a)) return (*c)->name == std::get<std::shared_ptr<Constant>>(b)->name;
+    if (auto v = std::get_if<std::shared_ptr<Variable>>(&a)) return (*v)->name == std::get<std::shared_ptr<Variable>>(b)->name;
+    if (auto l = std::get_if<std::shared_ptr<Lambda>>(&a)) {
+        auto lb = std::get<std::shared_ptr<Lambda>>(b);
+        return (*l)->param == lb->param && same_expr((*l)->body, lb->body);
+    }
+    auto aa = std::get<std::shared_ptr<Apply>>(a);
+    auto ab = std::get<std::shared_ptr<Apply>>(b);
+    return same_expr(aa->func, ab->func) && same_expr(aa->arg, ab->arg);
+}
+
+void test_nbe() {
+    std::cout << "Тест 10: Нормализация вычислением\n";
+    Type o = make_typeconst("o");
+    // λx.(λy.y) x: normalize не заходит под лямбду, normalize_nbe даёт λx.x
+    Expr under_lambda = lam("x", app(lam("y", var("y")), var("x")));
+    // (λx.λy.x) y: параметр переименовывается, свободная y не захватывается
+    Expr capture = app(lam("x", lam("y", var("x"))), var("y"));
+    // K a Ω: аргумент, который не нужен, не вычисляется
+    Expr omega = app(lam("w", app(var("w"), var("w"))), lam("w", app(var("w"), var("w"))));
+    Expr lazy = app(app(lam("x", lam("y", var("x"))), make_constant("a", o)), omega);
+    for (const Expr& expr : {under_lambda, capture, lazy}) {
+        std::cout << "Выражение: ";
+        print_expr(expr);
+        std::cout << "\nnormalize_nbe: ";
+        print_expr(normalize_nbe(expr));
+        std::cout << "\n";
+    }
+    std::cout << "\n";
+}
+
+// Сбалансированное дерево применений над константами с одной переменной x в крайнем левом листе
+Expr constant_tree(int leaves, bool with_x) {
+    Type o = make_typeconst("o");
+    if (leaves == 1) return with_x ? make_variable("x", o) : make_constant("c", o);
+    return make_apply(constant_tree(leaves / 2, with_x), constant_tree(leaves - leaves / 2, false));
+}
+
+void collect_nodes(const Expr& expr, std::unordered_set<const void*>& nodes) {
+    const void* node = std::visit([](const auto& n) -> const void* { return n.get(); }, expr);
+    if (!nodes.insert(node).second) return;
+    if (auto l = std::get_if<std::shared_ptr<Lambda>>(&expr)) collect_nodes((*l)->body, nodes);
+    if (auto a = std::get_if<std::shared_ptr<Apply>>(&expr)) {
+        collect_nodes((*a)->func, nodes);
+        collect_nodes((*a)->arg, nodes);
+    }
+}
+
+// Узлы результата, которых нет в исходном выражении
+size_t new_nodes(const Expr& result, const std::unordered_set<const void*>& original) {
+    const void* node = std::visit([](const auto& n) -> const void* { return n.get(); }, result);
+    if (original.count(node)) return 0;
+    if (auto l = std::get_if<std::shared_ptr<Lambda>>(&result)) return 1 + new_nodes((*l)->body, original);
+    if (auto a = std::get_if<std::shared_ptr<Apply>>(&result)) {
+        return 1 + new_nodes((*a)->func, original) + new_nodes((*a)->arg, original);
+    }
+    return 1;
+}
+
+void test_substitute() {
+    std::cout << "Тест 11: Подстановка без захвата\n";
+    Expr lambda_y = lam("y", var("x"));
+    std::cout << "[x := y] ";
+    print_expr(lambda_y);
+    std::cout << " = ";
+    print_expr(substitute(lambda_y, "x", var("y")));
+    std::cout << "\nnormalize ";
+    Expr captured = app(lam("x", lam("y", var("x"))), var("y"));
+    print_expr(captured);
+    std::cout << " = ";
+    print_expr(normalize(captured));
+    std::cout << "\n";
+    
+    Type o = make_typeconst("o");
+    for (int leaves : {1000, 100000}) {
+        Expr tree = constant_tree(leaves, true);
+        std::unordered_set<const void*> original;
+        collect_nodes(tree, original);
+        auto start = std::chrono::high_resolution_clock::now();
+        Expr result = substitute(tree, "x", make_constant("d", o));
+        auto end = std::chrono::high_resolution_clock::now();
+        Expr untouched = substitute(tree, "z", make_constant("d", o));
+        std::cout << "Подстановка в дерево из " << original.size() << " узлов: новых узлов " << new_nodes(result, original)
+                  << ", " << std::chrono::duration<double, std::milli>(end - start).count() << " мс; без вхождений — "
+                  << (untouched == tree ? "тот же узел" : "копия") << "\n";
+    }
+    std::cout << "\n";
+}
+
+// n f x для нумерала n с константами s : o -> o и z : o
+void bench_church_arithmetic() {
+    Type o = make_typeconst("o");
+    Expr s = make_constant("s", make_arrow(o, o));
+    Expr z = make_constant("z", o);
+    
+    struct Case { std::string name; Expr term; };
+    std::vector<Case> cases = {
+        {"plus 500 500", app(app(church_plus(), church_numeral(500)), church_numeral(500))},
+        {"mult 30 30", app(app(church_mult(), church_numeral(30)), church_numeral(30))},
+        {"mult 100 100", app(app(church_mult(), church_numeral(100)), church_numeral(100))},
+        {"exp 2 10", app(app(church_exp(), church_numeral(2)), church_numeral(10))},
+    };
+    
+    for (const auto& c : cases) {
+        Expr applied = app(app(c.term, s), z);
+        auto start = std::chrono::high_resolution_clock::now();
+        Expr by_reduce = normalize(applied);
+        auto middle = std::chrono::high_resolution_clock::now();
+        Expr by_nbe = normalize_nbe(applied);
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Чёрч " << c.name << ": normalize "
+                  << std::chrono::duration<double, std::milli>(middle - start).count() << " мс, normalize_nbe "
+                  << std::chrono::duration<double, std::milli>(end - middle).count() << " мс, "
+                  << (same_expr(by_reduce, by_nbe) ? "формы совпадают" : "формы различаются") << "\n";
+    }
+}
+
+void test_locally_nameless() {
+    std::cout << "Тест 12: Безымянное представление\n";
+    Type bool_type = make_typeconst("Bool");
+    Expr apply_fx = lam("f", lam("x", app(var("f"), var("x"))));
+    Expr captured = app(lam("x", lam("y", var("x"))), var("y"));
+    
+    std::cout << "Туда и обратно: ";
+    print_expr(to_named(to_locally_nameless(apply_fx)));
+    std::cout << "\nln_normalize ";
+    print_expr(captured);
+    std::cout << " = ";
+    print_expr(to_named(ln_normalize(to_locally_nameless(captured))));
+    std::cout << "\n[x := y] λy.x = ";
+    print_expr(to_named(ln_substitute(to_locally_nameless(lam("y", var("x"))), name_id("x"), to_locally_nameless(var("y")))));
+    std::cout << "\nТип: " << type_to_string_full(ln_infer_type(to_locally_nameless(apply_fx), {})) << "\n";
+    
+    TypeContext context;
+    context["b"] = bool_type;
+    Expr not_b = app(lam("x", app(make_constant("not", make_arrow(bool_type, bool_type)), var("x"))), var("b"));
+    std::cout << "Тип со свободной b: " << type_to_string_full(ln_infer_type(to_locally_nameless(not_b), to_ln_context(context))) << "\n";
+    try {
+        ln_infer_type(to_locally_nameless(app(make_lambda("x", bool_type, make_variable("x", bool_type)),
+                                              make_constant("0", make_typeconst("Int")))), {});
+    } catch (const std::exception& e) {
+        std::cout << "Ошибка типизации (ожидаемо): " << e.what() << "\n";
+    }
+    std::cout << "\n";
+}
+
+void bench_locally_nameless() {
+    Type o = make_typeconst("o");
+    Expr s = make_constant("s", make_arrow(o, o));
+    Expr z = make_constant("z", o);
+    
+    struct Case { std::string name; Expr term; };
+    std::vector<Case> cases = {
+        {"mult 30 30", app(app(church_mult(), church_numeral(30)), church_numeral(30))},
+        {"mult 100 100", app(app(church_mult(), church_numeral(100)), church_numeral(100))},
+        {"exp 2 10", app(app(church_exp(), church_numeral(2)), church_numeral(10))},
+    };
+    for (const auto& c : cases) {
+        Expr applied = app(app(c.term, s), z);
+        LnExpr nameless = to_locally_nameless(applied);
+        auto start = std::chrono::high_resolution_clock::now();
+        Expr named = normalize(applied);
+        auto middle = std::chrono::high_resolution_clock::now();
+        LnExpr result = ln_normalize(nameless);
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Чёрч " << c.name << ": normalize "
+                  << std::chrono::duration<double, std::milli>(middle - start).count() << " мс, ln_normalize "
+                  << std::chrono::duration<double, std::milli>(end - middle).count() << " мс, "
+                  << (same_expr(named, to_named(result)) ? "формы совпадают" : "формы различаются") << "\n";
+    }
+    
+    Type bool_type = make_typeconst("Bool");
+    Expr k = make_constant("k", make_arrow(bool_type, make_arrow(bool_type, bool_type)));
+    Expr true_const = make_constant("true", bool_type);
+    Expr named_tree = balanced_applications(100000, k, true_const);
+    LnExpr nameless_tree = to_locally_nameless(balanced_applications(100000, k, true_const));
+    TypeContext context;
+    auto start = std::chrono::high_resolution_clock::now();
+    infer_type(named_tree, context);
+    auto middle = std::chrono::high_resolution_clock::now();
+    ln_infer_type(nameless_tree, {});
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Вывод типа, 100000 применений: infer_type "
+              << std::chrono::duration<double, std::milli>(middle - start).count() << " мс, ln_infer_type "
+              << std::chrono::duration<double, std::milli>(end - middle).count() << " мс\n";
 }
 
 int main() {
     try {
         run_tests();
+        test_nbe();
+        test_substitute();
+        test_locally_nameless();
+        bench_infer_applications();
+        bench_infer_nested_lambdas();
+        bench_church_arithmetic();
+        bench_locally_nameless();
     } catch (const std::exception& e) {
         std::cerr << "Ошибка: " << e.what() << std::endl;
         return 1;
@@ -0,0 +1,51 @@
+// Просмотр двоичной трассы cam2:
+//   g++ -std=c++20 cam_trace.cpp -o cam_trace
+//   ./cam_trace trace.bin [первая_запись [число_записей]]
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "cam_trace.hpp"
+
+std::string format_record(const TraceRecord& record) {
+    std::string op = record.opcode < TRACE_OPCODE_COUNT ? TRACE_OPCODES[record.opcode] : "?";
+    if (op == "access") op += "[" + std::to_string(record.operand) + "]";
+    else if (op == "push" || op == "const") op += " " + std::to_string(record.operand);
+
+    std::string term = record.term_type < TRACE_TERM_TYPE_COUNT ? TRACE_TERM_TYPES[record.term_type] : "?";
+    if (term == "number" || term == "atom") term += " " + std::to_string(record.term_value);
+
+    std::ostringstream out;
+    out << std::setw(10) << record.step << " | "
+        << std::setw(6) << record.pc << " | "
+        << std::setw(12) << op << " | "
+        << std::setw(14) << term << " | "
+        << std::setw(6) << record.stack_depth << " | "
+        << std::setw(6) << record.dump_depth;
+    return out.str();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Использование: " << argv[0] << " trace.bin [первая_запись [число_записей]]" << std::endl;
+        return 1;
+    }
+
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+    if (!read_trace(argv[1], header, records)) {
+        std::cerr << "Не удалось прочитать трассу: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    size_t first = argc > 2 ? std::stoul(argv[2]) : 0;
+    size_t count = argc > 3 ? std::stoul(argv[3]) : records.size();
+
+    std::cout << "Шагов: " << header.total_steps << ", записей: " << header.record_count << std::endl;
+    std::cout << "      Step |     PC |      Command |           Term |  Stack |   Dump" << std::endl;
+    for (size_t i = first; i < records.size() && i - first < count; ++i) {
+        std::cout << format_record(records[i]) << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef CAM_TRACE_H
+#define CAM_TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Двоичная трасса машины cam2: файл из заголовка и записей фиксированного размера.
+// Запись снимается перед исполнением команды, как строка текстовой трассы.
+
+constexpr uint32_t TRACE_MAGIC = 0x32524354;   // "TCR2"
+constexpr uint32_t TRACE_VERSION = 1;
+
+struct TraceHeader {
+    uint32_t magic = TRACE_MAGIC;
+    uint32_t version = TRACE_VERSION;
+    uint64_t total_steps = 0;    // сколько шагов было записано за прогон
+    uint64_t record_count = 0;   // сколько из них сохранено (кольцо хранит последние)
+};
+
+struct TraceRecord {
+    uint64_t step;
+    int64_t term_value;          // число или номер атома; для ссылочных термов 0
+    uint32_t pc;
+    uint32_t stack_depth;
+    uint32_t dump_depth;
+    int32_t operand;             // индекс access или число константы команды
+    uint8_t opcode;              // Instruction::Type
+    uint8_t term_type;           // Term::Type
+    uint16_t reserved;
+    uint32_t reserved2;
+};
+
+static_assert(sizeof(TraceRecord) == 40, "TraceRecord must stay 40 bytes");
+
+// Порядок совпадает с Instruction::Type и Term::Type в cam2.cpp
+inline const char* const TRACE_OPCODES[] = {
+    "push", "swap", "cons", "car", "cdr", "quote", "cur", "app", "access", "dup", "const",
+    "add", "sub", "mul", "eq", "lt", "branch", "fix", "return"
+};
+constexpr size_t TRACE_OPCODE_COUNT = sizeof(TRACE_OPCODES) / sizeof(TRACE_OPCODES[0]);
+
+inline const char* const TRACE_TERM_TYPES[] = {
+    "()", "atom", "pair", "closure", "number", "quote", "code", "vector"
+};
+constexpr size_t TRACE_TERM_TYPE_COUNT = sizeof(TRACE_TERM_TYPES) / sizeof(TRACE_TERM_TYPES[0]);
+
+inline bool write_trace(const std::string& path, const TraceHeader& header,
+                        const std::vector<TraceRecord>& records) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(records.data(), sizeof(TraceRecord), records.size(), file) == records.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+inline bool read_trace(const std::string& path, TraceHeader& header, std::vector<TraceRecord>& records) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == TRACE_MAGIC && header.version == TRACE_VERSION;
+    if (ok) {
+        records.resize(header.record_count);
+        ok = std::fread(records.data(), sizeof(TraceRecord), records.size(), file) == records.size();
+    }
+    std::fclose(file);
+    return ok;
+}
+
+#endif